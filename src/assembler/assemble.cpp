@@ -0,0 +1,1006 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "assemble.h"
+#include "../disassembler/debug_info.h"
+
+
+static char upper(char c)
+{
+    return 'a' <= c && c <= 'z' ? char(c - 'a' + 'A') : c;
+}
+
+/*
+ * Case insensitive compare of a source token against an upper case keyword.
+ */
+static bool keyword(const char *name, size_t length, const char *word)
+{
+    size_t i = 0;
+    for(; i < length && word[i]; i++)
+        if(upper(name[i]) != word[i])
+            return false;
+    return i == length && !word[i];
+}
+
+static bool isIdentifierStart(char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_' || c == '.';
+}
+
+static bool isIdentifierChar(char c)
+{
+    return isIdentifierStart(c) || ('0' <= c && c <= '9');
+}
+
+
+Assembler::Assembler()
+{
+    cur = end = NULL;
+    line = 0;
+    clear();
+}
+
+void Assembler::clear()
+{
+    words.clear();
+    errors.clear();
+    symbols.clear();
+    names.clear();
+    fixups.clear();
+    terms.clear();
+    source.clear();
+    lines.clear();
+    patches.clear();
+    table.assign(1024, 0);
+}
+
+/*
+ * Memory maps a source file and assembles it.
+ *
+ * @return false if the file couldn't be read or had errors.
+ */
+bool Assembler::assembleFile(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+    {
+        clear();
+        error(0, std::string("can't open ") + path);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        clear();
+        error(0, std::string("can't read ") + path);
+        return false;
+    }
+
+    if(st.st_size == 0)
+    {
+        close(fd);
+        return assemble("", 0);
+    }
+
+    void *source = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(source == MAP_FAILED)
+    {
+        clear();
+        error(0, std::string("can't map ") + path);
+        return false;
+    }
+
+    madvise(source, st.st_size, MADV_SEQUENTIAL);
+    bool ok = assemble(static_cast<const char*>(source), st.st_size);
+    munmap(source, st.st_size);
+
+    return ok;
+}
+
+/*
+ * Assembles source text. Previous output and symbols are discarded. The text
+ * is copied so it can be reassembled later.
+ *
+ * @return false if there were errors.
+ */
+bool Assembler::assemble(const char *text, size_t length)
+{
+    clear();
+    source.assign(text, length);
+    assembleFrom(1, 0);
+    return errors.empty();
+}
+
+/*
+ * Replaces num_lines source lines starting at first_line (counted from 1)
+ * with text, and reassembles from first_line on. Output before that line is
+ * kept, except for words referencing labels that moved. The words that
+ * differ from the previous output are available from getPatches(). Words
+ * past the new end of the program aren't reported.
+ *
+ * @return false if the lines are out of range or there were errors.
+ */
+bool Assembler::reassemble(uint32_t first_line, uint32_t num_lines, const char *text, size_t length)
+{
+    patches.clear();
+
+    if(first_line == 0 || first_line > lines.size() + 1)
+        return false;
+
+    uint32_t last_line = std::min<uint32_t>(first_line - 1 + num_lines, lines.size());
+    size_t begin = first_line <= lines.size() ? lines[first_line-1].offset : source.size();
+    size_t end = last_line < lines.size() ? lines[last_line].offset : source.size();
+
+    std::string replacement(text, length);
+    if(begin == source.size() && begin > 0 && source[begin-1] != '\n')
+        replacement.insert(replacement.begin(), '\n');
+    else if(!replacement.empty() && replacement[replacement.size()-1] != '\n' && end < source.size())
+        replacement += '\n';
+
+    source.replace(begin, end - begin, replacement);
+
+    std::vector<uint16_t> previous(words);
+
+    /* appended lines restart at the last line, which is rerun unchanged. */
+    uint32_t restart = std::max<uint32_t>(1, std::min<uint32_t>(first_line, lines.size()));
+
+    /* rewind to the state before the restart line. */
+    size_t offset = 0;
+    if(!lines.empty())
+    {
+        const Line &start = lines[restart-1];
+        offset = start.offset;
+        words.resize(start.word);
+        fixups.resize(start.fixup);
+        terms.resize(start.term);
+        errors.resize(start.error);
+        lines.resize(restart-1);
+    }
+
+    for(size_t i = 0; i < symbols.size(); i++)
+        if(symbols[i].defined && symbols[i].line >= restart)
+            symbols[i].defined = false;
+
+    assembleFrom(restart, offset);
+
+    if(!errors.empty())
+        return false;
+
+    makePatches(previous);
+    return true;
+}
+
+/*
+ * Runs the first pass from the start of a line through the end of the
+ * source, then resolves every fixup.
+ *
+ * @param offset Offset of first_line in the source.
+ */
+void Assembler::assembleFrom(uint32_t first_line, size_t offset)
+{
+    cur = source.data() + offset;
+    end = source.data() + source.size();
+    line = first_line;
+
+    while(cur < end)
+    {
+        Line info;
+        info.offset = cur - source.data();
+        info.word = words.size();
+        info.fixup = fixups.size();
+        info.term = terms.size();
+        info.error = errors.size();
+        lines.push_back(info);
+
+        assembleLine();
+    }
+
+    if(words.size() > DCPU16::MEMORY_SIZE)
+        error(line, "program is larger than memory");
+
+    resolve();
+
+    cur = end = NULL;
+}
+
+/*
+ * Collects the runs of words that differ from the previous output.
+ */
+void Assembler::makePatches(const std::vector<uint16_t> &previous)
+{
+    size_t common = std::min(previous.size(), words.size());
+    size_t i = 0;
+
+    while(i < common)
+    {
+        if(previous[i] == words[i])
+        {
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+        while(i < common && previous[i] != words[i])
+            i++;
+
+        Patch patch;
+        patch.address = uint16_t(start);
+        patch.count = i - start;
+        patches.push_back(patch);
+    }
+
+    if(words.size() > common)
+    {
+        Patch patch;
+        patch.address = uint16_t(common);
+        patch.count = words.size() - common;
+        patches.push_back(patch);
+    }
+}
+
+const std::vector<uint16_t>& Assembler::getWords() const
+{
+    return words;
+}
+
+const std::vector<Assembler::Error>& Assembler::getErrors() const
+{
+    return errors;
+}
+
+const std::vector<Assembler::Patch>& Assembler::getPatches() const
+{
+    return patches;
+}
+
+uint32_t Assembler::getLineCount() const
+{
+    return lines.size();
+}
+
+bool Assembler::findSymbol(const char *name, uint16_t *value) const
+{
+    size_t length = strlen(name);
+    uint32_t index = lookup(name, length, hashName(name, length));
+
+    if(!index || !symbols[index-1].defined)
+        return false;
+
+    *value = symbols[index-1].value;
+    return true;
+}
+
+/*
+ * Writes the source line of every output word and the defined labels as
+ * debug info.
+ *
+ * @return false if the file couldn't be written.
+ */
+bool Assembler::writeDebugInfo(const char *path) const
+{
+    uint32_t num_words = std::min<uint32_t>(words.size(), DCPU16::MEMORY_SIZE);
+    std::vector<DebugInfo::LineEntry> line_entries;
+    std::vector<DebugInfo::Label> labels;
+
+    for(size_t i = 0; i < lines.size(); i++)
+    {
+        uint32_t next = i+1 < lines.size() ? lines[i+1].word : num_words;
+        if(lines[i].word >= std::min(next, num_words))
+            continue;
+
+        DebugInfo::LineEntry entry;
+        entry.address = uint16_t(lines[i].word);
+        entry.reserved = 0;
+        entry.line = i + 1;
+        line_entries.push_back(entry);
+    }
+
+    for(size_t i = 0; i < symbols.size(); i++)
+    {
+        if(!symbols[i].defined)
+            continue;
+
+        DebugInfo::Label label;
+        label.address = symbols[i].value;
+        label.name = &names[symbols[i].name];
+        label.length = symbols[i].length;
+        labels.push_back(label);
+    }
+
+    return DebugInfo::save(path, num_words, line_entries, labels);
+}
+
+void Assembler::assembleLine()
+{
+    size_t num_errors = errors.size();
+    const char *name;
+    size_t length;
+
+    skipSpace();
+
+    if(accept(':'))
+    {
+        if(!parseIdentifier(&name, &length))
+        {
+            error("expected label name after ':'");
+            skipLine();
+            return;
+        }
+
+        defineLabel(name, length);
+        skipSpace();
+    }
+
+    if(!atLineEnd())
+    {
+        if(!parseIdentifier(&name, &length))
+        {
+            error("expected instruction");
+            skipLine();
+            return;
+        }
+
+        if(accept(':'))
+        {
+            defineLabel(name, length);
+            skipSpace();
+
+            if(atLineEnd())
+            {
+                skipLine();
+                return;
+            }
+
+            if(!parseIdentifier(&name, &length))
+            {
+                error("expected instruction");
+                skipLine();
+                return;
+            }
+        }
+
+        if(keyword(name, length, "DAT") || keyword(name, length, ".DAT"))
+            assembleData();
+        else
+            assembleInstruction(name, length);
+    }
+
+    skipSpace();
+    if(!atLineEnd() && errors.size() == num_errors)
+        error("unexpected text after instruction");
+
+    skipLine();
+}
+
+void Assembler::assembleInstruction(const char *mnemonic, size_t length)
+{
+    int op = -1;
+    bool special = false;
+
+    for(int i = 0; i < DCPU16::NUM_OPERATIONS && op < 0; i++)
+    {
+        const char *basic = DCPU16::basic_operations[i].name;
+        const char *ext = DCPU16::special_operations[i].name;
+
+        if(basic && keyword(mnemonic, length, basic))
+            op = i;
+        else if(ext && keyword(mnemonic, length, ext))
+            op = i, special = true;
+    }
+
+    if(op < 0)
+    {
+        error("unknown instruction '" + std::string(mnemonic, length) + "'");
+        return;
+    }
+
+    Operand a, b;
+
+    if(special)
+    {
+        if(!parseOperand(&a, true))
+            return;
+
+        words.push_back(uint16_t((op << DCPU16::INST_VB_SHIFT) | (a.code << DCPU16::INST_VA_SHIFT)));
+    }
+    else
+    {
+        if(!parseOperand(&b, false))
+            return;
+
+        skipSpace();
+        if(!accept(','))
+        {
+            error("expected ',' after first operand");
+            return;
+        }
+
+        if(!parseOperand(&a, true))
+            return;
+
+        words.push_back(uint16_t(op | (b.code << DCPU16::INST_VB_SHIFT) | (a.code << DCPU16::INST_VA_SHIFT)));
+    }
+
+    /* next words follow in the order the cpu reads them, a before b. */
+    if(a.has_word)
+        emitWord(a.expr);
+    if(!special && b.has_word)
+        emitWord(b.expr);
+}
+
+void Assembler::assembleData()
+{
+    do
+    {
+        skipSpace();
+
+        if(accept('"'))
+        {
+            while(cur < end && *cur != '"' && *cur != '\n')
+                words.push_back(uint8_t(*cur++));
+
+            if(!accept('"'))
+            {
+                error("unterminated string");
+                return;
+            }
+        }
+        else
+        {
+            Expression expr;
+            if(!parseExpression(&expr))
+                return;
+            emitWord(expr);
+        }
+
+        skipSpace();
+    } while(accept(','));
+}
+
+/*
+ * Second pass. Patches every word that referenced a label which wasn't
+ * defined when the word was emitted.
+ */
+void Assembler::resolve()
+{
+    for(size_t i = 0; i < fixups.size(); i++)
+    {
+        const Fixup &fixup = fixups[i];
+        int32_t value = fixup.constant;
+        bool ok = true;
+
+        for(uint32_t t = fixup.first_term; t < fixup.first_term + fixup.num_terms; t++)
+        {
+            const Symbol &symbol = symbols[terms[t].symbol];
+
+            if(!symbol.defined)
+            {
+                error(fixup.line, "undefined label '" + std::string(&names[symbol.name], symbol.length) + "'");
+                ok = false;
+                break;
+            }
+
+            value += terms[t].sign * symbol.value;
+        }
+
+        if(ok)
+            words[fixup.word] = uint16_t(value);
+    }
+}
+
+/*
+ * Parses an operand and picks its encoding.
+ *
+ * @param is_a True for operand a, which may hold short literals.
+ */
+bool Assembler::parseOperand(Operand *operand, bool is_a)
+{
+    operand->has_word = false;
+    operand->expr.constant = 0;
+    operand->expr.first_term = terms.size();
+    operand->expr.num_terms = 0;
+
+    skipSpace();
+
+    if(accept('['))
+    {
+        int reg = -1;
+        int32_t sign = 1;
+        bool has_value = false;
+
+        skipSpace();
+        if(accept('-'))
+            sign = -1;
+
+        while(true)
+        {
+            const char *name;
+            size_t length;
+            int32_t number;
+
+            skipSpace();
+
+            const char *start = cur;
+            if(parseIdentifier(&name, &length) && (number = parseRegister(name, length)) >= 0)
+            {
+                if(reg >= 0 || sign < 0)
+                {
+                    error("invalid register in address");
+                    return false;
+                }
+                reg = number;
+            }
+            else
+            {
+                cur = start;
+
+                Expression term;
+                if(!parseExpression(&term))
+                    return false;
+
+                /* parseExpression consumes trailing sums, fold them in. */
+                operand->expr.constant += sign * term.constant;
+                for(uint32_t t = term.first_term; t < term.first_term + term.num_terms; t++)
+                    terms[t].sign *= sign;
+                operand->expr.num_terms = terms.size() - operand->expr.first_term;
+                has_value = true;
+            }
+
+            skipSpace();
+            if(accept('+'))
+                sign = 1;
+            else if(accept('-'))
+                sign = -1;
+            else
+                break;
+        }
+
+        if(!accept(']'))
+        {
+            error("expected ']'");
+            return false;
+        }
+
+        operand->has_word = has_value;
+
+        /* register operand ranges end at the OPERAND_REGISTER* constants. */
+        if(reg == DCPU16::NUM_REGISTERS)
+            operand->code = has_value ? DCPU16::OPERAND_PICK : DCPU16::OPERAND_PEEK;
+        else if(reg >= 0 && has_value)
+            operand->code = uint16_t(DCPU16::OPERAND_REGISTER_PTR + 1 + reg);
+        else if(reg >= 0)
+            operand->code = uint16_t(DCPU16::OPERAND_REGISTER + 1 + reg);
+        else
+            operand->code = DCPU16::OPERAND_NEXT_WORD_PTR;
+
+        return true;
+    }
+
+    const char *start = cur;
+    const char *name;
+    size_t length;
+
+    if(parseIdentifier(&name, &length))
+    {
+        int reg = parseRegister(name, length);
+        int code = -1;
+
+        if(0 <= reg && reg < DCPU16::NUM_REGISTERS)
+            code = reg;
+        else if(reg == DCPU16::NUM_REGISTERS)
+            code = DCPU16::OPERAND_SP;
+        else if(keyword(name, length, "PC"))
+            code = DCPU16::OPERAND_PC;
+        else if(keyword(name, length, "EX"))
+            code = DCPU16::OPERAND_EX;
+        else if(keyword(name, length, "PUSH") || keyword(name, length, "POP"))
+        {
+            /* the same code is PUSH as operand b and POP as operand a. */
+            if(keyword(name, length, is_a ? "PUSH" : "POP"))
+            {
+                error(is_a ? "PUSH can only be operand b" : "POP can only be operand a");
+                return false;
+            }
+            code = DCPU16::OPERAND_PUSH_POP;
+        }
+        else if(keyword(name, length, "PEEK"))
+            code = DCPU16::OPERAND_PEEK;
+        else if(keyword(name, length, "PICK"))
+        {
+            operand->code = DCPU16::OPERAND_PICK;
+            operand->has_word = true;
+            return parseExpression(&operand->expr);
+        }
+
+        if(code >= 0)
+        {
+            operand->code = uint16_t(code);
+            return true;
+        }
+
+        /* a label, parse it as an expression. */
+        cur = start;
+    }
+
+    if(!parseExpression(&operand->expr))
+        return false;
+
+    uint16_t value;
+    if(is_a && evaluate(operand->expr, &value) && (value <= 30 || value == 0xFFFF))
+    {
+        /* short literal, -1 is encoded first. */
+        operand->code = uint16_t(DCPU16::OPERAND_LITERAL + uint16_t(value + 1));
+        releaseTerms(operand->expr);
+        return true;
+    }
+
+    operand->code = DCPU16::OPERAND_NEXT_WORD_LITERAL;
+    operand->has_word = true;
+    return true;
+}
+
+/*
+ * Parses a sum of numbers, characters and labels.
+ */
+bool Assembler::parseExpression(Expression *expr)
+{
+    expr->constant = 0;
+    expr->first_term = terms.size();
+    expr->num_terms = 0;
+
+    int32_t sign = 1;
+
+    skipSpace();
+    if(accept('-'))
+        sign = -1;
+
+    while(true)
+    {
+        const char *name;
+        size_t length;
+        int32_t value;
+
+        skipSpace();
+
+        if(cur + 2 < end && cur[0] == '\'' && cur[2] == '\'')
+        {
+            expr->constant += sign * uint8_t(cur[1]);
+            cur += 3;
+        }
+        else if(parseNumber(&value))
+        {
+            expr->constant += sign * value;
+        }
+        else if(parseIdentifier(&name, &length))
+        {
+            if(parseRegister(name, length) >= 0)
+            {
+                error("register '" + std::string(name, length) + "' used as a value");
+                return false;
+            }
+
+            Term term;
+            term.symbol = intern(name, length);
+            term.sign = sign;
+            terms.push_back(term);
+        }
+        else
+        {
+            error("expected a value");
+            return false;
+        }
+
+        /* stop before a register so [value + reg] can be parsed. */
+        const char *before = cur;
+        skipSpace();
+
+        if(cur < end && (*cur == '+' || *cur == '-'))
+        {
+            const char *op = cur++;
+            skipSpace();
+
+            const char *reg_name;
+            size_t reg_length;
+            const char *after = cur;
+            bool is_reg = parseIdentifier(&reg_name, &reg_length) && parseRegister(reg_name, reg_length) >= 0;
+            cur = after;
+
+            if(is_reg)
+            {
+                cur = before;
+                break;
+            }
+
+            sign = *op == '+' ? 1 : -1;
+            continue;
+        }
+
+        cur = before;
+        break;
+    }
+
+    expr->num_terms = terms.size() - expr->first_term;
+    return true;
+}
+
+bool Assembler::parseNumber(int32_t *value)
+{
+    if(cur >= end || *cur < '0' || *cur > '9')
+        return false;
+
+    uint32_t result = 0;
+    bool too_large = false;
+    int base = 10;
+
+    if(cur + 1 < end && cur[0] == '0' && (cur[1] == 'x' || cur[1] == 'X'))
+        base = 16, cur += 2;
+    else if(cur + 1 < end && cur[0] == '0' && (cur[1] == 'b' || cur[1] == 'B'))
+        base = 2, cur += 2;
+
+    const char *start = cur;
+
+    for(; cur < end; cur++)
+    {
+        char c = upper(*cur);
+        int digit;
+
+        if('0' <= c && c <= '9')
+            digit = c - '0';
+        else if('A' <= c && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            break;
+
+        if(digit >= base)
+            break;
+
+        result = result * base + digit;
+        too_large = too_large || result > 0xFFFF;
+        result &= 0xFFFF;
+    }
+
+    if(cur == start || (cur < end && isIdentifierChar(*cur)))
+    {
+        error("invalid number");
+        while(cur < end && isIdentifierChar(*cur))
+            cur++;
+    }
+    else if(too_large)
+        error("number doesn't fit in 16 bits");
+
+    *value = int32_t(result);
+    return true;
+}
+
+bool Assembler::parseIdentifier(const char **name, size_t *length)
+{
+    if(cur >= end || !isIdentifierStart(*cur))
+        return false;
+
+    *name = cur;
+    while(cur < end && isIdentifierChar(*cur))
+        cur++;
+    *length = cur - *name;
+
+    return true;
+}
+
+/*
+ * @return 0-7 for general registers, 8 for SP, or -1.
+ */
+int Assembler::parseRegister(const char *name, size_t length) const
+{
+    if(length == 1)
+    {
+        switch(upper(name[0]))
+        {
+        case 'A': return DCPU16::REG_A;
+        case 'B': return DCPU16::REG_B;
+        case 'C': return DCPU16::REG_C;
+        case 'X': return DCPU16::REG_X;
+        case 'Y': return DCPU16::REG_Y;
+        case 'Z': return DCPU16::REG_Z;
+        case 'I': return DCPU16::REG_I;
+        case 'J': return DCPU16::REG_J;
+        default: break;
+        }
+    }
+
+    if(keyword(name, length, "SP"))
+        return DCPU16::NUM_REGISTERS;
+
+    return -1;
+}
+
+void Assembler::skipSpace()
+{
+    while(cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r'))
+        cur++;
+}
+
+bool Assembler::accept(char c)
+{
+    if(cur < end && *cur == c)
+    {
+        cur++;
+        return true;
+    }
+    return false;
+}
+
+bool Assembler::atLineEnd()
+{
+    return cur >= end || *cur == '\n' || *cur == ';';
+}
+
+void Assembler::skipLine()
+{
+    const char *nl = static_cast<const char*>(memchr(cur, '\n', end - cur));
+    cur = nl ? nl + 1 : end;
+    line++;
+}
+
+/*
+ * Emits the value of an expression, or a placeholder and a fixup if it
+ * references labels that aren't defined yet.
+ */
+void Assembler::emitWord(const Expression &expr)
+{
+    uint16_t value;
+
+    if(evaluate(expr, &value))
+    {
+        words.push_back(value);
+        releaseTerms(expr);
+        return;
+    }
+
+    Fixup fixup;
+    fixup.word = words.size();
+    fixup.line = line;
+    fixup.constant = expr.constant;
+    fixup.first_term = expr.first_term;
+    fixup.num_terms = expr.num_terms;
+
+    fixups.push_back(fixup);
+    words.push_back(0);
+}
+
+/*
+ * Drops the terms of a resolved expression if nothing was added after them.
+ */
+void Assembler::releaseTerms(const Expression &expr)
+{
+    if(expr.first_term + expr.num_terms == terms.size())
+        terms.resize(expr.first_term);
+}
+
+bool Assembler::evaluate(const Expression &expr, uint16_t *value) const
+{
+    int32_t result = expr.constant;
+
+    for(uint32_t t = expr.first_term; t < expr.first_term + expr.num_terms; t++)
+    {
+        const Symbol &symbol = symbols[terms[t].symbol];
+        if(!symbol.defined)
+            return false;
+        result += terms[t].sign * symbol.value;
+    }
+
+    *value = uint16_t(result);
+    return true;
+}
+
+/*
+ * @return Index of the symbol with the given name, adding it if needed.
+ */
+uint32_t Assembler::intern(const char *name, size_t length)
+{
+    uint32_t hash = hashName(name, length);
+    uint32_t index = lookup(name, length, hash);
+
+    if(index)
+        return index - 1;
+
+    if((symbols.size() + 1) * 2 > table.size())
+        growTable();
+
+    Symbol symbol;
+    symbol.name = names.size();
+    symbol.length = length;
+    symbol.hash = hash;
+    symbol.line = 0;
+    symbol.value = 0;
+    symbol.defined = false;
+
+    names.insert(names.end(), name, name + length);
+    symbols.push_back(symbol);
+
+    uint32_t mask = table.size() - 1;
+    uint32_t slot = hash & mask;
+    while(table[slot])
+        slot = (slot + 1) & mask;
+    table[slot] = symbols.size();
+
+    return symbols.size() - 1;
+}
+
+/*
+ * @return Index+1 of the symbol with the given name, or 0.
+ */
+uint32_t Assembler::lookup(const char *name, size_t length, uint32_t hash) const
+{
+    uint32_t mask = table.size() - 1;
+
+    for(uint32_t slot = hash & mask; table[slot]; slot = (slot + 1) & mask)
+    {
+        const Symbol &symbol = symbols[table[slot] - 1];
+
+        if(symbol.hash == hash && symbol.length == length &&
+           memcmp(&names[symbol.name], name, length) == 0)
+            return table[slot];
+    }
+
+    return 0;
+}
+
+void Assembler::defineLabel(const char *name, size_t length)
+{
+    Symbol &symbol = symbols[intern(name, length)];
+
+    if(symbol.defined)
+    {
+        error("label '" + std::string(name, length) + "' already defined");
+        return;
+    }
+
+    symbol.defined = true;
+    symbol.value = uint16_t(words.size());
+    symbol.line = line;
+}
+
+void Assembler::growTable()
+{
+    table.assign(table.size() * 2, 0);
+    uint32_t mask = table.size() - 1;
+
+    for(size_t i = 0; i < symbols.size(); i++)
+    {
+        uint32_t slot = symbols[i].hash & mask;
+        while(table[slot])
+            slot = (slot + 1) & mask;
+        table[slot] = i + 1;
+    }
+}
+
+/*
+ * FNV-1a
+ */
+uint32_t Assembler::hashName(const char *name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++)
+        hash = (hash ^ uint8_t(name[i])) * 16777619u;
+    return hash;
+}
+
+void Assembler::error(const std::string &message)
+{
+    error(line, message);
+}
+
+void Assembler::error(uint32_t line, const std::string &message)
+{
+    Error err;
+    err.line = line;
+    err.message = message;
+    errors.push_back(err);
+}
@@ -0,0 +1,207 @@
+/*
+ * Two pass DCPU-16 1.7 assembler.
+ *
+ * The first pass tokenizes the source and emits words directly. Operand
+ * values that depend on labels not defined yet are emitted as 0 and recorded
+ * as fixups, which the second pass resolves once all labels are known.
+ *
+ * Literals in operand a use the short form when their value is known during
+ * the first pass and fits in [-1, 30]. Forward references always use a next
+ * word so instruction sizes never change in the second pass.
+ *
+ * Syntax:
+ *   ; comment
+ *   :label  or  label:
+ *   SET b, a
+ *   JSR a
+ *   DAT 1, 0x2, label, "text"
+ *
+ * Operands are registers, SP, PC, EX, PUSH, POP, PEEK, PICK n, [reg],
+ * [reg + n], [n], [SP + n] and literals. PUSH is only valid as operand b
+ * and POP only as operand a. Literals are sums and differences of decimal,
+ * 0x hex and 0b binary numbers, characters and labels. Numbers must fit in
+ * 16 bits.
+ * Mnemonics and register names are case insensitive, labels are not.
+ *
+ * The source is kept after assembly so edited lines can be reassembled with
+ * reassemble(). The first pass restarts at the first edited line from the
+ * state recorded there and always runs to the end of the source, not just
+ * over the edited lines, and every fixup is resolved again. The words that
+ * changed are reported as patches, which EmulatorThread::patch() writes
+ * into a running program.
+ *
+ * writeDebugInfo() saves the source line of every output word and the
+ * labels' addresses for debuggers and disassemblers (see debug_info.h).
+ */
+
+#ifndef ASSEMBLE_H
+#define ASSEMBLE_H
+
+#include <string>
+#include <vector>
+#include "../dcpu16/dcpu16.h"
+
+class Assembler
+{
+/*---------------------------------------------------------------------------
+ * Types
+ *--------------------------------------------------------------------------*/
+public:
+    struct Error
+    {
+        uint32_t    line;
+        std::string message;
+    };
+
+    /* A run of output words that changed in the last reassembly. */
+    struct Patch
+    {
+        uint16_t address;
+        uint32_t count;
+    };
+
+private:
+    /* Where a source line starts and the output state before it. */
+    struct Line
+    {
+        uint32_t offset;
+        uint32_t word;
+        uint32_t fixup;
+        uint32_t term;
+        uint32_t error;
+    };
+
+    struct Symbol
+    {
+        uint32_t name;
+        uint32_t length;
+        uint32_t hash;
+        uint32_t line;
+        uint16_t value;
+        bool     defined;
+    };
+
+    /*
+     * A word whose value depends on labels. The value is constant plus the
+     * signed sum of num_terms symbols starting at first_term.
+     */
+    struct Fixup
+    {
+        uint32_t word;
+        uint32_t line;
+        int32_t  constant;
+        uint32_t first_term;
+        uint32_t num_terms;
+    };
+
+    struct Term
+    {
+        uint32_t symbol;
+        int32_t  sign;
+    };
+
+    struct Expression
+    {
+        int32_t  constant;
+        uint32_t first_term;
+        uint32_t num_terms;
+    };
+
+    struct Operand
+    {
+        uint16_t code;
+        bool     has_word;
+        Expression expr;
+    };
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    std::vector<uint16_t> words;
+    std::vector<Error> errors;
+
+    /* Interned symbols in an open addressing hash table of index+1. */
+    std::vector<Symbol> symbols;
+    std::vector<char> names;
+    std::vector<uint32_t> table;
+
+    std::vector<Fixup> fixups;
+    std::vector<Term> terms;
+
+    std::string source;
+    std::vector<Line> lines;
+    std::vector<Patch> patches;
+
+    /* Parse state. */
+    const char *cur;
+    const char *end;
+    uint32_t line;
+
+
+/*---------------------------------------------------------------------------
+ * Assembly
+ *--------------------------------------------------------------------------*/
+public:
+                        Assembler();
+
+    bool                assembleFile(const char *path);
+    bool                assemble(const char *text, size_t length);
+    bool                reassemble(uint32_t first_line, uint32_t num_lines, const char *text, size_t length);
+    void                clear();
+
+    const std::vector<uint16_t>& getWords() const;
+    const std::vector<Error>& getErrors() const;
+    const std::vector<Patch>& getPatches() const;
+    bool                findSymbol(const char *name, uint16_t *value) const;
+    uint32_t            getLineCount() const;
+    bool                writeDebugInfo(const char *path) const;
+
+private:
+    void                assembleFrom(uint32_t first_line, size_t offset);
+    void                makePatches(const std::vector<uint16_t> &previous);
+    void                assembleLine();
+    void                assembleInstruction(const char *mnemonic, size_t length);
+    void                assembleData();
+    void                resolve();
+
+
+/*---------------------------------------------------------------------------
+ * Parsing
+ *--------------------------------------------------------------------------*/
+private:
+    bool                parseOperand(Operand *operand, bool is_a);
+    bool                parseExpression(Expression *expr);
+    bool                parseNumber(int32_t *value);
+    bool                parseIdentifier(const char **name, size_t *length);
+    int                 parseRegister(const char *name, size_t length) const;
+    void                skipSpace();
+    bool                accept(char c);
+    bool                atLineEnd();
+    void                skipLine();
+    void                emitWord(const Expression &expr);
+    bool                evaluate(const Expression &expr, uint16_t *value) const;
+    void                releaseTerms(const Expression &expr);
+
+
+/*---------------------------------------------------------------------------
+ * Symbols
+ *--------------------------------------------------------------------------*/
+private:
+    uint32_t            intern(const char *name, size_t length);
+    uint32_t            lookup(const char *name, size_t length, uint32_t hash) const;
+    void                defineLabel(const char *name, size_t length);
+    void                growTable();
+    static uint32_t     hashName(const char *name, size_t length);
+
+
+/*---------------------------------------------------------------------------
+ * Errors
+ *--------------------------------------------------------------------------*/
+private:
+    void                error(const std::string &message);
+    void                error(uint32_t line, const std::string &message);
+};
+
+#endif /* ASSEMBLE_H */
@@ -0,0 +1,72 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "assemble.h"
+
+/*
+ * Usage: assembler [-g] [-o output] source
+ *
+ * Writes the program as raw words in host byte order, the format the
+ * disassembler reads. The output defaults to the source path with .bin
+ * appended. With -g the source lines and labels are written to the output
+ * path with .dbg appended.
+ */
+int main(int argc, char **argv)
+{
+    const char *source = NULL;
+    std::string output;
+    bool debug_info = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-g") == 0)
+            debug_info = true;
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+            output = argv[++i];
+        else
+            source = argv[i];
+    }
+
+    if(!source)
+    {
+        fprintf(stderr, "usage: assembler [-g] [-o output] source\n");
+        return 1;
+    }
+
+    if(output.empty())
+        output = std::string(source) + ".bin";
+
+    Assembler assembler;
+
+    if(!assembler.assembleFile(source))
+    {
+        const std::vector<Assembler::Error> &errors = assembler.getErrors();
+
+        for(size_t i = 0; i < errors.size(); i++)
+            fprintf(stderr, "%s:%u: error: %s\n", source, errors[i].line, errors[i].message.c_str());
+
+        return 1;
+    }
+
+    FILE *file = fopen(output.c_str(), "wb");
+    if(!file)
+    {
+        fprintf(stderr, "assembler: can't write %s\n", output.c_str());
+        return 1;
+    }
+
+    const std::vector<uint16_t> &words = assembler.getWords();
+    if(!words.empty())
+        fwrite(&words[0], sizeof(uint16_t), words.size(), file);
+
+    fclose(file);
+
+    std::string debug_path = output + ".dbg";
+    if(debug_info && !assembler.writeDebugInfo(debug_path.c_str()))
+    {
+        fprintf(stderr, "assembler: can't write %s\n", debug_path.c_str());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Arithmetic kernels of the DCPU-16 operations. Each returns the value
+ * written to b and the new value of EX, computed in 32 bit arithmetic
+ * without branches. Division by zero masks the result to 0 instead of
+ * branching around the divide.
+ *
+ * arithmetic_check compares every kernel against a 64 bit reference model
+ * over all (a, b) pairs.
+ */
+
+#ifndef ARITHMETIC_H
+#define ARITHMETIC_H
+
+#include <algorithm>
+#include "../library/pstdint.h"
+
+class Arithmetic
+{
+public:
+    static uint16_t add(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        uint32_t r = uint32_t(b) + a;
+        *ex = uint16_t(r >> 16);
+        return uint16_t(r);
+    }
+
+    /* underflow borrows from the upper half, setting EX to 0xFFFF. */
+    static uint16_t sub(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        uint32_t r = uint32_t(b) - a;
+        *ex = uint16_t(r >> 16);
+        return uint16_t(r);
+    }
+
+    static uint16_t mul(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        uint32_t r = uint32_t(b) * a;
+        *ex = uint16_t(r >> 16);
+        return uint16_t(r);
+    }
+
+    static uint16_t mli(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        uint32_t r = uint32_t(int32_t(int16_t(b)) * int16_t(a));
+        *ex = uint16_t(r >> 16);
+        return uint16_t(r);
+    }
+
+    /* (b<<16)/a holds b/a in its upper half and EX in its lower half. */
+    static uint16_t div(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        uint32_t mask = -uint32_t(a != 0);
+        uint32_t r = ((uint32_t(b) << 16) / (a | (a == 0))) & mask;
+        *ex = uint16_t(r);
+        return uint16_t(r >> 16);
+    }
+
+    /*
+     * Signed division rounds towards 0. -0x8000 << 16 divided by -1 doesn't
+     * fit in 32 bits, so this one divide is done in 64 bits.
+     */
+    static uint16_t dvi(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        int64_t mask = -int64_t(a != 0);
+        int64_t r = (int64_t(int16_t(b)) * 0x10000 / (int16_t(a) | (a == 0))) & mask;
+        *ex = uint16_t(r);
+        return uint16_t(r / 0x10000);
+    }
+
+    static uint16_t mod(uint16_t b, uint16_t a)
+    {
+        return uint16_t((b % (a | (a == 0))) & -(a != 0));
+    }
+
+    /* the result has the sign of b. */
+    static uint16_t mdi(uint16_t b, uint16_t a)
+    {
+        return uint16_t((int16_t(b) % (int16_t(a) | (a == 0))) & -(a != 0));
+    }
+
+    /*
+     * Shifts work on b<<16 so the bits shifted out of b land in the lower
+     * half for EX. Shifts of 32 or more are masked rather than left
+     * undefined.
+     */
+    static uint16_t shr(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        uint32_t r = ((uint32_t(b) << 16) >> (a & 31)) & -uint32_t(a < 32);
+        *ex = uint16_t(r);
+        return uint16_t(r >> 16);
+    }
+
+    /* shifts past 31 give the same result as 31: all sign bits. */
+    static uint16_t asr(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        int32_t r = int32_t(uint32_t(b) << 16) >> std::min<uint16_t>(a, 31);
+        *ex = uint16_t(r);
+        return uint16_t(r >> 16);
+    }
+
+    static uint16_t shl(uint16_t b, uint16_t a, uint16_t *ex)
+    {
+        uint32_t r = (uint32_t(b) << (a & 31)) & -uint32_t(a < 32);
+        *ex = uint16_t(r >> 16);
+        return uint16_t(r);
+    }
+
+    /* EX is 1 on overflow, even if the carry in was large enough to add 2. */
+    static uint16_t adx(uint16_t b, uint16_t a, uint16_t ex_in, uint16_t *ex)
+    {
+        uint32_t r = uint32_t(b) + a + ex_in;
+        *ex = r > 0xFFFF;
+        return uint16_t(r);
+    }
+
+    /*
+     * EX is added as a signed value, so the 0xFFFF borrow SUB leaves behind
+     * subtracts 1 and multi word subtraction chains. EX becomes 0xFFFF on
+     * underflow and 1 on overflow.
+     */
+    static uint16_t sbx(uint16_t b, uint16_t a, uint16_t ex_in, uint16_t *ex)
+    {
+        int32_t r = int32_t(b) - a + int16_t(ex_in);
+        *ex = uint16_t(-(r < 0)) | (r > 0xFFFF);
+        return uint16_t(r);
+    }
+};
+
+#endif /* ARITHMETIC_H */
@@ -0,0 +1,381 @@
+#include <cstdio>
+#include <cstdlib>
+#include <strings.h>
+#include <algorithm>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include "arithmetic.h"
+
+/*
+ * Usage: arithmetic_check [-j threads] [operation]...
+ *
+ * Compares the arithmetic kernels against a model of the spec that works on
+ * 64 bit values with plain branches, for all 2^32 (a, b) pairs. ADX and SBX
+ * are checked for every pair with each of EX_VALUES as the carry in. Only
+ * the named operations are checked if any are given.
+ *
+ * Exits with 1 if any value written to b or EX differs from the model.
+ */
+
+struct Result
+{
+    uint16_t value;
+    uint16_t ex;
+};
+
+static const uint16_t EX_VALUES[] = {0x0000, 0x0001, 0x7FFF, 0x8000, 0xFFFF};
+
+static Result result(int64_t value, int64_t ex)
+{
+    Result r;
+    r.value = uint16_t(value & 0xFFFF);
+    r.ex = uint16_t(ex & 0xFFFF);
+    return r;
+}
+
+/*
+ * Each operation has the kernel under test and its model. USES_EX is set
+ * for operations that read EX.
+ */
+struct Add
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::add(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        int64_t r = int64_t(b) + a;
+        return result(r, r > 0xFFFF ? 1 : 0);
+    }
+};
+
+struct Sub
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::sub(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        int64_t r = int64_t(b) - a;
+        return result(r, r < 0 ? 0xFFFF : 0);
+    }
+};
+
+struct Mul
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::mul(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        int64_t r = int64_t(b) * a;
+        return result(r, r / 0x10000);
+    }
+};
+
+struct Mli
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::mli(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        int64_t r = int64_t(int16_t(b)) * int16_t(a);
+        return result(r, int64_t(uint64_t(r) >> 16));
+    }
+};
+
+struct Div
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::div(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        if(a == 0)
+            return result(0, 0);
+        return result(int64_t(b) / a, int64_t(b) * 0x10000 / a);
+    }
+};
+
+struct Dvi
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::dvi(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        if(a == 0)
+            return result(0, 0);
+
+        int64_t sb = int16_t(b);
+        int64_t sa = int16_t(a);
+        return result(sb / sa, sb * 0x10000 / sa);
+    }
+};
+
+struct Mod
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::mod(b, a); r.ex = 0; return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        return result(a == 0 ? 0 : int64_t(b) % a, 0);
+    }
+};
+
+struct Mdi
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::mdi(b, a); r.ex = 0; return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        return result(a == 0 ? 0 : int64_t(int16_t(b)) % int16_t(a), 0);
+    }
+};
+
+struct Shr
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::shr(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        uint64_t r = a >= 48 ? 0 : (uint64_t(b) << 16) >> a;
+        return result(int64_t(r >> 16), int64_t(r));
+    }
+};
+
+struct Asr
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::asr(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        /* past 40 every bit of b<<16 is shifted out, leaving the sign. */
+        int64_t r = int64_t(int16_t(b)) * 0x10000;
+        int64_t d = int64_t(1) << std::min<int>(a, 40);
+        int64_t w = r / d - (r % d < 0 ? 1 : 0);
+        return result(int64_t(uint64_t(w) >> 16), w);
+    }
+};
+
+struct Shl
+{
+    enum { USES_EX = 0 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t) { Result r; r.value = Arithmetic::shl(b, a, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t)
+    {
+        uint64_t r = a >= 48 ? 0 : uint64_t(b) << a;
+        return result(int64_t(r), int64_t(r >> 16));
+    }
+};
+
+struct Adx
+{
+    enum { USES_EX = 1 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t ex) { Result r; r.value = Arithmetic::adx(b, a, ex, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t ex)
+    {
+        int64_t r = int64_t(b) + a + ex;
+        return result(r, r > 0xFFFF ? 1 : 0);
+    }
+};
+
+struct Sbx
+{
+    enum { USES_EX = 1 };
+    static Result kernel(uint16_t b, uint16_t a, uint16_t ex) { Result r; r.value = Arithmetic::sbx(b, a, ex, &r.ex); return r; }
+    static Result model(uint16_t b, uint16_t a, uint16_t ex)
+    {
+        int64_t r = int64_t(b) - a + int16_t(ex);
+        return result(r, r < 0 ? 0xFFFF : r > 0xFFFF ? 1 : 0);
+    }
+};
+
+
+enum
+{
+    /* Values of b a worker takes at a time. */
+    CHUNK_SIZE = 256,
+};
+
+struct Mismatch
+{
+    uint16_t b, a, ex;
+    Result   got;
+    Result   expected;
+};
+
+/*
+ * Sweep of one operation shared by the workers, which take chunks of b
+ * values until all are done.
+ */
+struct Sweep
+{
+    uint32_t next_b;
+    uint64_t mismatches;
+    Mismatch first;
+    pthread_mutex_t lock;
+};
+
+static bool mismatchLess(const Mismatch &x, const Mismatch &y)
+{
+    if(x.b != y.b)
+        return x.b < y.b;
+    if(x.a != y.a)
+        return x.a < y.a;
+    return x.ex < y.ex;
+}
+
+template<class OP>
+static void* sweepWorker(void *data)
+{
+    Sweep *sweep = static_cast<Sweep*>(data);
+    size_t num_ex = OP::USES_EX ? sizeof(EX_VALUES) / sizeof(EX_VALUES[0]) : 1;
+
+    uint64_t mismatches = 0;
+    Mismatch first;
+
+    while(true)
+    {
+        pthread_mutex_lock(&sweep->lock);
+        uint32_t begin = sweep->next_b;
+        sweep->next_b += CHUNK_SIZE;
+        pthread_mutex_unlock(&sweep->lock);
+
+        if(begin > 0xFFFF)
+            break;
+
+        for(uint32_t b = begin; b < begin + CHUNK_SIZE; b++)
+        {
+            for(size_t i = 0; i < num_ex; i++)
+            {
+                uint16_t ex = OP::USES_EX ? EX_VALUES[i] : 0;
+
+                for(uint32_t a = 0; a <= 0xFFFF; a++)
+                {
+                    Result got = OP::kernel(uint16_t(b), uint16_t(a), ex);
+                    Result expected = OP::model(uint16_t(b), uint16_t(a), ex);
+
+                    if(got.value == expected.value && got.ex == expected.ex)
+                        continue;
+
+                    Mismatch m;
+                    m.b = uint16_t(b);
+                    m.a = uint16_t(a);
+                    m.ex = ex;
+                    m.got = got;
+                    m.expected = expected;
+
+                    if(!mismatches++ || mismatchLess(m, first))
+                        first = m;
+                }
+            }
+        }
+    }
+
+    pthread_mutex_lock(&sweep->lock);
+    if(mismatches && (!sweep->mismatches || mismatchLess(first, sweep->first)))
+        sweep->first = first;
+    sweep->mismatches += mismatches;
+    pthread_mutex_unlock(&sweep->lock);
+
+    return NULL;
+}
+
+struct Check
+{
+    const char *name;
+    void* (*worker)(void *data);
+};
+
+static const Check CHECKS[] = {
+    {"ADD", sweepWorker<Add>},
+    {"SUB", sweepWorker<Sub>},
+    {"MUL", sweepWorker<Mul>},
+    {"MLI", sweepWorker<Mli>},
+    {"DIV", sweepWorker<Div>},
+    {"DVI", sweepWorker<Dvi>},
+    {"MOD", sweepWorker<Mod>},
+    {"MDI", sweepWorker<Mdi>},
+    {"SHR", sweepWorker<Shr>},
+    {"ASR", sweepWorker<Asr>},
+    {"SHL", sweepWorker<Shl>},
+    {"ADX", sweepWorker<Adx>},
+    {"SBX", sweepWorker<Sbx>},
+};
+
+static const size_t NUM_CHECKS = sizeof(CHECKS) / sizeof(CHECKS[0]);
+
+/*
+ * Sweeps one operation on num_threads threads, the calling thread being
+ * one of them.
+ *
+ * @return false if the kernel differs from the model.
+ */
+static bool runCheck(const Check &check, int num_threads)
+{
+    Sweep sweep;
+    sweep.next_b = 0;
+    sweep.mismatches = 0;
+    pthread_mutex_init(&sweep.lock, NULL);
+
+    std::vector<pthread_t> threads(num_threads);
+    for(int i = 1; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, check.worker, &sweep);
+
+    check.worker(&sweep);
+
+    for(int i = 1; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&sweep.lock);
+
+    if(!sweep.mismatches)
+    {
+        printf("%s ok\n", check.name);
+        return true;
+    }
+
+    const Mismatch &m = sweep.first;
+    printf("%s: %llu mismatches, first at b=0x%04X a=0x%04X ex=0x%04X: "
+           "got 0x%04X ex 0x%04X, expected 0x%04X ex 0x%04X\n",
+           check.name, (unsigned long long)sweep.mismatches, m.b, m.a, m.ex,
+           m.got.value, m.got.ex, m.expected.value, m.expected.ex);
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads = int(sysconf(_SC_NPROCESSORS_ONLN));
+    std::vector<bool> selected(NUM_CHECKS, argc <= 1);
+    bool ok = true;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcasecmp(argv[i], "-j") == 0 && i+1 < argc)
+        {
+            num_threads = atoi(argv[++i]);
+            continue;
+        }
+
+        size_t j = 0;
+        while(j < NUM_CHECKS && strcasecmp(argv[i], CHECKS[j].name) != 0)
+            j++;
+
+        if(j == NUM_CHECKS)
+        {
+            fprintf(stderr, "usage: arithmetic_check [-j threads] [operation]...\n");
+            return 1;
+        }
+
+        selected[j] = true;
+    }
+
+    /* only -j was given. */
+    if(std::find(selected.begin(), selected.end(), true) == selected.end())
+        selected.assign(NUM_CHECKS, true);
+
+    num_threads = std::max(1, num_threads);
+
+    for(size_t i = 0; i < NUM_CHECKS; i++)
+        if(selected[i] && !runCheck(CHECKS[i], num_threads))
+            ok = false;
+
+    return ok ? 0 : 1;
+}
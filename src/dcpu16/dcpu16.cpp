@@ -1,28 +1,463 @@
-#include <cmath>
 #include <cstring>
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
 
 #include "dcpu16.h"
+#include "arithmetic.h"
 
+/* RuntimeStats counts each error, so it needs one counter per error. */
+typedef char check_max_errors[int(RuntimeStats::MAX_ERRORS) == int(DCPU16::NUM_ERRORS) ? 1 : -1];
+
+/*
+ * Copies words into memory, wrapping around its end.
+ */
+static void copyWords(uint16_t *mem, uint16_t addr, const uint16_t *words, uint32_t count)
+{
+    uint32_t first = std::min<uint32_t>(count, DCPU16::MEMORY_SIZE - addr);
+
+    std::copy(words, words + first, mem + addr);
+    std::copy(words + first, words + count, mem);
+}
+
+/*
+ * Saturating increment of an access counter.
+ */
+static inline void countAccess(uint16_t *counts, uint16_t addr)
+{
+    counts[addr] += counts[addr] != 0xFFFF;
+}
+
+
+RuntimeStats::RuntimeStats()
+{
+    instructions = 0;
+    cycles = 0;
+    interrupts = 0;
+    std::fill(hwi_calls, hwi_calls + MAX_DEVICES, 0);
+    hwi_other = 0;
+    std::fill(errors, errors + MAX_ERRORS, 0);
+    history_bytes = 0;
+}
 
 InstructionData::InstructionData()
 {
     instruction = 0;
     instruction_address = 0;
-    op = oa = ob = 0;
-    a = b = 0;
-    aptr = bptr = NULL;
-    cycles = 0;
 }
 
 
+/*
+ * Instruction set tables. See the OperationInfo and OperandInfo
+ * declarations in dcpu16.h.
+ */
+#define V DCPU16::OPERATION_VALID
+#define C DCPU16::OPERATION_CONDITIONAL
+#define W DCPU16::OPERATION_WRITES
+
+const OperationInfo DCPU16::basic_operations[NUM_OPERATIONS] = {
+    /* 0x00 */ {NULL,  0, 0},
+    /* 0x01 */ {"SET", 1, V | W},
+    /* 0x02 */ {"ADD", 2, V | W},
+    /* 0x03 */ {"SUB", 2, V | W},
+    /* 0x04 */ {"MUL", 2, V | W},
+    /* 0x05 */ {"MLI", 2, V | W},
+    /* 0x06 */ {"DIV", 3, V | W},
+    /* 0x07 */ {"DVI", 3, V | W},
+    /* 0x08 */ {"MOD", 3, V | W},
+    /* 0x09 */ {"MDI", 3, V | W},
+    /* 0x0A */ {"AND", 1, V | W},
+    /* 0x0B */ {"BOR", 1, V | W},
+    /* 0x0C */ {"XOR", 1, V | W},
+    /* 0x0D */ {"SHR", 1, V | W},
+    /* 0x0E */ {"ASR", 1, V | W},
+    /* 0x0F */ {"SHL", 1, V | W},
+    /* 0x10 */ {"IFB", 2, V | C},
+    /* 0x11 */ {"IFC", 2, V | C},
+    /* 0x12 */ {"IFE", 2, V | C},
+    /* 0x13 */ {"IFN", 2, V | C},
+    /* 0x14 */ {"IFG", 2, V | C},
+    /* 0x15 */ {"IFA", 2, V | C},
+    /* 0x16 */ {"IFL", 2, V | C},
+    /* 0x17 */ {"IFU", 2, V | C},
+    /* 0x18 */ {NULL,  0, 0},
+    /* 0x19 */ {NULL,  0, 0},
+    /* 0x1A */ {"ADX", 3, V | W},
+    /* 0x1B */ {"SBX", 3, V | W},
+    /* 0x1C */ {NULL,  0, 0},
+    /* 0x1D */ {NULL,  0, 0},
+    /* 0x1E */ {"STI", 2, V | W},
+    /* 0x1F */ {"STD", 2, V | W},
+};
+
+const OperationInfo DCPU16::special_operations[NUM_OPERATIONS] = {
+    /* 0x00 */ {NULL,  0, 0},
+    /* 0x01 */ {"JSR", 3, V},
+    /* 0x02 */ {NULL,  0, 0},
+    /* 0x03 */ {NULL,  0, 0},
+    /* 0x04 */ {NULL,  0, 0},
+    /* 0x05 */ {NULL,  0, 0},
+    /* 0x06 */ {NULL,  0, 0},
+    /* 0x07 */ {NULL,  0, 0},
+    /* 0x08 */ {"INT", 4, V},
+    /* 0x09 */ {"IAG", 1, V | W},
+    /* 0x0A */ {"IAS", 1, V},
+    /* 0x0B */ {"RFI", 3, V},
+    /* 0x0C */ {"IAQ", 2, V},
+    /* 0x0D */ {NULL,  0, 0},
+    /* 0x0E */ {NULL,  0, 0},
+    /* 0x0F */ {NULL,  0, 0},
+    /* 0x10 */ {"HWN", 2, V | W},
+    /* 0x11 */ {"HWQ", 4, V},
+    /* 0x12 */ {"HWI", 4, V},
+    /* 0x13 */ {NULL,  0, 0},
+    /* 0x14 */ {NULL,  0, 0},
+    /* 0x15 */ {NULL,  0, 0},
+    /* 0x16 */ {NULL,  0, 0},
+    /* 0x17 */ {NULL,  0, 0},
+    /* 0x18 */ {NULL,  0, 0},
+    /* 0x19 */ {NULL,  0, 0},
+    /* 0x1A */ {NULL,  0, 0},
+    /* 0x1B */ {NULL,  0, 0},
+    /* 0x1C */ {NULL,  0, 0},
+    /* 0x1D */ {NULL,  0, 0},
+    /* 0x1E */ {NULL,  0, 0},
+    /* 0x1F */ {NULL,  0, 0},
+};
+
+#undef V
+#undef C
+#undef W
+
+const OperandInfo DCPU16::operands[NUM_OPERANDS] = {
+    /* 0x00 */ {MODE_REGISTER,               0, 0, 0, 0}, /* A */
+    /* 0x01 */ {MODE_REGISTER,               1, 0, 0, 0}, /* B */
+    /* 0x02 */ {MODE_REGISTER,               2, 0, 0, 0}, /* C */
+    /* 0x03 */ {MODE_REGISTER,               3, 0, 0, 0}, /* X */
+    /* 0x04 */ {MODE_REGISTER,               4, 0, 0, 0}, /* Y */
+    /* 0x05 */ {MODE_REGISTER,               5, 0, 0, 0}, /* Z */
+    /* 0x06 */ {MODE_REGISTER,               6, 0, 0, 0}, /* I */
+    /* 0x07 */ {MODE_REGISTER,               7, 0, 0, 0}, /* J */
+    /* 0x08 */ {MODE_REGISTER_PTR,           0, 0, 0, 0}, /* [A] */
+    /* 0x09 */ {MODE_REGISTER_PTR,           1, 0, 0, 0}, /* [B] */
+    /* 0x0A */ {MODE_REGISTER_PTR,           2, 0, 0, 0}, /* [C] */
+    /* 0x0B */ {MODE_REGISTER_PTR,           3, 0, 0, 0}, /* [X] */
+    /* 0x0C */ {MODE_REGISTER_PTR,           4, 0, 0, 0}, /* [Y] */
+    /* 0x0D */ {MODE_REGISTER_PTR,           5, 0, 0, 0}, /* [Z] */
+    /* 0x0E */ {MODE_REGISTER_PTR,           6, 0, 0, 0}, /* [I] */
+    /* 0x0F */ {MODE_REGISTER_PTR,           7, 0, 0, 0}, /* [J] */
+    /* 0x10 */ {MODE_REGISTER_NEXT_WORD_PTR, 0, 1, 1, 0}, /* [A + next word] */
+    /* 0x11 */ {MODE_REGISTER_NEXT_WORD_PTR, 1, 1, 1, 0}, /* [B + next word] */
+    /* 0x12 */ {MODE_REGISTER_NEXT_WORD_PTR, 2, 1, 1, 0}, /* [C + next word] */
+    /* 0x13 */ {MODE_REGISTER_NEXT_WORD_PTR, 3, 1, 1, 0}, /* [X + next word] */
+    /* 0x14 */ {MODE_REGISTER_NEXT_WORD_PTR, 4, 1, 1, 0}, /* [Y + next word] */
+    /* 0x15 */ {MODE_REGISTER_NEXT_WORD_PTR, 5, 1, 1, 0}, /* [Z + next word] */
+    /* 0x16 */ {MODE_REGISTER_NEXT_WORD_PTR, 6, 1, 1, 0}, /* [I + next word] */
+    /* 0x17 */ {MODE_REGISTER_NEXT_WORD_PTR, 7, 1, 1, 0}, /* [J + next word] */
+    /* 0x18 */ {MODE_PUSH_POP,               0, 0, 0, 0}, /* PUSH / POP */
+    /* 0x19 */ {MODE_PEEK,                   0, 0, 0, 0}, /* PEEK */
+    /* 0x1A */ {MODE_PICK,                   0, 1, 1, 0}, /* PICK next word */
+    /* 0x1B */ {MODE_SP,                     0, 0, 0, 0}, /* SP */
+    /* 0x1C */ {MODE_PC,                     0, 0, 0, 0}, /* PC */
+    /* 0x1D */ {MODE_EX,                     0, 0, 0, 0}, /* EX */
+    /* 0x1E */ {MODE_NEXT_WORD_PTR,          0, 1, 1, 0}, /* [next word] */
+    /* 0x1F */ {MODE_NEXT_WORD_LITERAL,      0, 1, 1, 0}, /* next word */
+    /* 0x20 */ {MODE_LITERAL,                0, 0, 0, 0xFFFF},
+    /* 0x21 */ {MODE_LITERAL,                0, 0, 0, 0x0000},
+    /* 0x22 */ {MODE_LITERAL,                0, 0, 0, 0x0001},
+    /* 0x23 */ {MODE_LITERAL,                0, 0, 0, 0x0002},
+    /* 0x24 */ {MODE_LITERAL,                0, 0, 0, 0x0003},
+    /* 0x25 */ {MODE_LITERAL,                0, 0, 0, 0x0004},
+    /* 0x26 */ {MODE_LITERAL,                0, 0, 0, 0x0005},
+    /* 0x27 */ {MODE_LITERAL,                0, 0, 0, 0x0006},
+    /* 0x28 */ {MODE_LITERAL,                0, 0, 0, 0x0007},
+    /* 0x29 */ {MODE_LITERAL,                0, 0, 0, 0x0008},
+    /* 0x2A */ {MODE_LITERAL,                0, 0, 0, 0x0009},
+    /* 0x2B */ {MODE_LITERAL,                0, 0, 0, 0x000A},
+    /* 0x2C */ {MODE_LITERAL,                0, 0, 0, 0x000B},
+    /* 0x2D */ {MODE_LITERAL,                0, 0, 0, 0x000C},
+    /* 0x2E */ {MODE_LITERAL,                0, 0, 0, 0x000D},
+    /* 0x2F */ {MODE_LITERAL,                0, 0, 0, 0x000E},
+    /* 0x30 */ {MODE_LITERAL,                0, 0, 0, 0x000F},
+    /* 0x31 */ {MODE_LITERAL,                0, 0, 0, 0x0010},
+    /* 0x32 */ {MODE_LITERAL,                0, 0, 0, 0x0011},
+    /* 0x33 */ {MODE_LITERAL,                0, 0, 0, 0x0012},
+    /* 0x34 */ {MODE_LITERAL,                0, 0, 0, 0x0013},
+    /* 0x35 */ {MODE_LITERAL,                0, 0, 0, 0x0014},
+    /* 0x36 */ {MODE_LITERAL,                0, 0, 0, 0x0015},
+    /* 0x37 */ {MODE_LITERAL,                0, 0, 0, 0x0016},
+    /* 0x38 */ {MODE_LITERAL,                0, 0, 0, 0x0017},
+    /* 0x39 */ {MODE_LITERAL,                0, 0, 0, 0x0018},
+    /* 0x3A */ {MODE_LITERAL,                0, 0, 0, 0x0019},
+    /* 0x3B */ {MODE_LITERAL,                0, 0, 0, 0x001A},
+    /* 0x3C */ {MODE_LITERAL,                0, 0, 0, 0x001B},
+    /* 0x3D */ {MODE_LITERAL,                0, 0, 0, 0x001C},
+    /* 0x3E */ {MODE_LITERAL,                0, 0, 0, 0x001D},
+    /* 0x3F */ {MODE_LITERAL,                0, 0, 0, 0x001E},
+};
+
+
+/*
+ * Hook policies. NoHooks compiles every hook away. CallbackHooks counts
+ * accesses and updates stats if counters and stats are attached, and
+ * forwards to the ExecutionHooks attached with setHooks(), if any.
+ * CoverageHooks only counts fetches in the attached EdgeCoverage.
+ */
+struct DCPU16::NoHooks
+{
+    static void onFetch(DCPU16 *, uint16_t, uint16_t)       { }
+    static void onRead(DCPU16 *, uint16_t, uint16_t)        { }
+    static void onWrite(DCPU16 *, uint16_t, uint16_t)       { }
+    static void onInterrupt(DCPU16 *, uint16_t)             { }
+    static void onHardwareInterrupt(DCPU16 *, uint16_t)     { }
+    static void onStep(DCPU16 *, uint64_t)                  { }
+};
+
+struct DCPU16::CallbackHooks
+{
+    static void onFetch(DCPU16 *cpu, uint16_t address, uint16_t instruction)
+    {
+        if(cpu->access_counters)
+            countAccess(cpu->access_counters->executes, address);
+
+        if(cpu->hooks && cpu->hooks->fetch)
+            cpu->hooks->fetch(cpu, address, instruction, cpu->hooks->data);
+    }
+
+    static void onRead(DCPU16 *cpu, uint16_t address, uint16_t value)
+    {
+        if(cpu->access_counters)
+            countAccess(cpu->access_counters->reads, address);
+
+        if(cpu->hooks && cpu->hooks->read)
+            cpu->hooks->read(cpu, address, value, cpu->hooks->data);
+    }
+
+    static void onWrite(DCPU16 *cpu, uint16_t address, uint16_t value)
+    {
+        if(cpu->access_counters)
+            countAccess(cpu->access_counters->writes, address);
+
+        const ExecutionHooks *hooks = cpu->hooks;
+        if(!hooks || !hooks->write)
+            return;
+
+        uint16_t page = address >> PAGE_SHIFT;
+        if(!hooks->write_pages || ((hooks->write_pages[page / 32] >> (page % 32)) & 1))
+            hooks->write(cpu, address, value, hooks->data);
+    }
+
+    static void onInterrupt(DCPU16 *cpu, uint16_t msg)
+    {
+        if(cpu->stats)
+            RuntimeStats::add(&cpu->stats->interrupts, 1);
+
+        if(cpu->hooks && cpu->hooks->interrupt)
+            cpu->hooks->interrupt(cpu, msg, cpu->hooks->data);
+    }
+
+    static void onHardwareInterrupt(DCPU16 *cpu, uint16_t device)
+    {
+        RuntimeStats *stats = cpu->stats;
+        if(stats)
+            RuntimeStats::add(device < RuntimeStats::MAX_DEVICES ? &stats->hwi_calls[device] : &stats->hwi_other, 1);
+    }
+
+    /* called after each instruction with the cycles it took. */
+    static void onStep(DCPU16 *cpu, uint64_t cycles)
+    {
+        if(cpu->stats)
+        {
+            RuntimeStats::add(&cpu->stats->instructions, 1);
+            RuntimeStats::add(&cpu->stats->cycles, cycles);
+        }
+    }
+};
+
+struct DCPU16::CoverageHooks : DCPU16::NoHooks
+{
+    static void onFetch(DCPU16 *cpu, uint16_t address, uint16_t)
+    {
+        EdgeCoverage *coverage = cpu->coverage;
+        if(!coverage)
+            return;
+
+        uint16_t location = hashAddress(address);
+        uint16_t edge = location ^ coverage->previous;
+        uint8_t &count = coverage->map[edge];
+
+        if(!count)
+            coverage->hits[coverage->num_hits++] = edge;
+
+        count += count != 0xFF;
+        coverage->previous = location >> 1;
+    }
+
+    /*
+     * Spreads addresses over the map. Every step is reversible, so no two
+     * addresses share a location.
+     */
+    static uint16_t hashAddress(uint16_t address)
+    {
+        uint16_t x = address ^ (address >> 7);
+        x = uint16_t(x * 0x9E3B);
+        return x ^ (x >> 8);
+    }
+};
+
+
+/*
+ * Operand accessors. resolve() does the operand's side effects, reading its
+ * next word or moving SP, and returns the address of memory operands.
+ * read() and write() then access the operand through that address. Writes
+ * to literals are ignored. Memory reads and writes are reported to HOOKS.
+ * CYCLES is the operand's cost, one for modes that read a next word.
+ */
+template<class HOOKS>
+struct DCPU16::MemoryOperand
+{
+    static uint16_t read(DCPU16 *cpu, const OperandInfo &, uint16_t address)
+    {
+        return cpu->readMemory<HOOKS>(address);
+    }
+
+    static void write(DCPU16 *cpu, const OperandInfo &, uint16_t address, uint16_t value)
+    {
+        cpu->writeMemory<HOOKS>(address, value);
+    }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_REGISTER, SOURCE, HOOKS>
+{
+    enum { CYCLES = 0 };
+
+    static uint16_t resolve(DCPU16 *, const OperandInfo &)                         { return 0; }
+    static uint16_t read(DCPU16 *cpu, const OperandInfo &info, uint16_t)           { return cpu->reg[info.reg]; }
+    static void     write(DCPU16 *cpu, const OperandInfo &info, uint16_t, uint16_t value) { cpu->reg[info.reg] = value; }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_REGISTER_PTR, SOURCE, HOOKS> : MemoryOperand<HOOKS>
+{
+    enum { CYCLES = 0 };
+
+    static uint16_t resolve(DCPU16 *cpu, const OperandInfo &info) { return cpu->reg[info.reg]; }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_REGISTER_NEXT_WORD_PTR, SOURCE, HOOKS> : MemoryOperand<HOOKS>
+{
+    enum { CYCLES = 1 };
+
+    static uint16_t resolve(DCPU16 *cpu, const OperandInfo &info) { return cpu->mem[cpu->pc++] + cpu->reg[info.reg]; }
+};
+
+/* a pops and b pushes. */
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_PUSH_POP, SOURCE, HOOKS> : MemoryOperand<HOOKS>
+{
+    enum { CYCLES = 0 };
+
+    static uint16_t resolve(DCPU16 *cpu, const OperandInfo &) { return SOURCE == OPERAND_SOURCE_A ? cpu->sp++ : --cpu->sp; }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_PEEK, SOURCE, HOOKS> : MemoryOperand<HOOKS>
+{
+    enum { CYCLES = 0 };
+
+    static uint16_t resolve(DCPU16 *cpu, const OperandInfo &) { return cpu->sp; }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_PICK, SOURCE, HOOKS> : MemoryOperand<HOOKS>
+{
+    enum { CYCLES = 1 };
+
+    static uint16_t resolve(DCPU16 *cpu, const OperandInfo &) { return cpu->sp + cpu->mem[cpu->pc++]; }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_SP, SOURCE, HOOKS>
+{
+    enum { CYCLES = 0 };
+
+    static uint16_t resolve(DCPU16 *, const OperandInfo &)                    { return 0; }
+    static uint16_t read(DCPU16 *cpu, const OperandInfo &, uint16_t)          { return cpu->sp; }
+    static void     write(DCPU16 *cpu, const OperandInfo &, uint16_t, uint16_t value) { cpu->sp = value; }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_PC, SOURCE, HOOKS>
+{
+    enum { CYCLES = 0 };
+
+    static uint16_t resolve(DCPU16 *, const OperandInfo &)                    { return 0; }
+    static uint16_t read(DCPU16 *cpu, const OperandInfo &, uint16_t)          { return cpu->pc; }
+    static void     write(DCPU16 *cpu, const OperandInfo &, uint16_t, uint16_t value) { cpu->pc = value; }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_EX, SOURCE, HOOKS>
+{
+    enum { CYCLES = 0 };
+
+    static uint16_t resolve(DCPU16 *, const OperandInfo &)                    { return 0; }
+    static uint16_t read(DCPU16 *cpu, const OperandInfo &, uint16_t)          { return cpu->ex; }
+    static void     write(DCPU16 *cpu, const OperandInfo &, uint16_t, uint16_t value) { cpu->ex = value; }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_NEXT_WORD_PTR, SOURCE, HOOKS> : MemoryOperand<HOOKS>
+{
+    enum { CYCLES = 1 };
+
+    static uint16_t resolve(DCPU16 *cpu, const OperandInfo &) { return cpu->mem[cpu->pc++]; }
+};
+
+/* the next word is returned as the address and read back as the value. */
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_NEXT_WORD_LITERAL, SOURCE, HOOKS>
+{
+    enum { CYCLES = 1 };
+
+    static uint16_t resolve(DCPU16 *cpu, const OperandInfo &)                 { return cpu->mem[cpu->pc++]; }
+    static uint16_t read(DCPU16 *, const OperandInfo &, uint16_t address)     { return address; }
+    static void     write(DCPU16 *, const OperandInfo &, uint16_t, uint16_t)  { }
+};
+
+template<int SOURCE, class HOOKS>
+struct DCPU16::Operand<DCPU16::MODE_LITERAL, SOURCE, HOOKS>
+{
+    enum { CYCLES = 0 };
+
+    static uint16_t resolve(DCPU16 *, const OperandInfo &)                    { return 0; }
+    static uint16_t read(DCPU16 *, const OperandInfo &info, uint16_t)         { return info.literal; }
+    static void     write(DCPU16 *, const OperandInfo &, uint16_t, uint16_t)  { }
+};
+
+
 DCPU16::DCPU16()
 {
+    access_counters = NULL;
+    stats = NULL;
+    hooks = NULL;
+    coverage = NULL;
+    input_log = NULL;
+    print_errors = true;
+
+    /* memory starts out unknown, so the first reset clears all of it. */
+    fork_parent = NULL;
+    std::fill(written_pages, written_pages + NUM_PAGES/32, 0xFFFFFFFF);
     reset();
 }
 
+/*
+ * Returns the cpu to its power on state. Only the memory pages written
+ * since the last reset are cleared, or all of them if the cpu was forked
+ * since. Access counters, stats, hooks and the input log stay attached.
+ */
 void DCPU16::reset()
 {
     pc = 0;
@@ -33,200 +468,286 @@ void DCPU16::reset()
     error = ERROR_NONE;
     last_instruction = InstructionData();
 
-    std::fill(mem, mem+MEMORY_SIZE, 0);
-    std::fill(mem_flags, mem_flags+MEMORY_SIZE, 0);
-    std::fill(reg, mem+NUM_REGISTERS, 0);
+    if(fork_parent)
+    {
+        std::fill(written_pages, written_pages + NUM_PAGES/32, 0xFFFFFFFF);
+        fork_parent = NULL;
+    }
+
+    restoreWrittenPages(NULL);
+    std::fill(reg, reg+NUM_REGISTERS, 0);
+
+    interrupt_queueing = false;
+    interrupt_head = 0;
+    interrupt_count = 0;
+
+    events.clear();
+    next_event = UINT64_MAX;
+
+    /* the input log starts over too. */
+    input_position = 0;
+    input_nested = false;
+    setInputLog(input_log);
+
+    for(size_t i = 0; i < devices.size(); i++)
+        if(devices[i].reset)
+            devices[i].reset(this, devices[i].data);
+}
+
+/*
+ * Makes this cpu a copy of parent. Memory is shared with the parent
+ * copy-on-write at page granularity: pages this cpu hasn't written since it
+ * was last forked from parent are left as they are, and only the written
+ * ones are copied back. The first fork from a parent copies all of memory,
+ * and parent must not change while cpus are forked from it. Access
+ * counters, stats, hooks and the input log stay attached as they are.
+ *
+ * Devices and their events are left out: their data belongs to the parent's
+ * devices, so a fork that could reach them would change the parent's
+ * hardware and have it interrupt the parent. The fork ends up with no
+ * devices attached, and HWN in it returns 0.
+ */
+void DCPU16::fork(const DCPU16 &parent)
+{
+    if(fork_parent != &parent)
+    {
+        std::fill(written_pages, written_pages + NUM_PAGES/32, 0xFFFFFFFF);
+        fork_parent = &parent;
+    }
+
+    restoreWrittenPages(&parent);
+
+    pc = parent.pc;
+    sp = parent.sp;
+    ex = parent.ex;
+    ia = parent.ia;
+    std::copy(parent.reg, parent.reg + NUM_REGISTERS, reg);
+    clock = parent.clock;
+    error = parent.error;
+    last_instruction = parent.last_instruction;
+
+    interrupt_queueing = parent.interrupt_queueing;
+    std::copy(parent.interrupt_queue, parent.interrupt_queue + MAX_INTERRUPTS, interrupt_queue);
+    interrupt_head = parent.interrupt_head;
+    interrupt_count = parent.interrupt_count;
+
+    detachAllDevices();
+
+    input_position = parent.input_position;
+    input_nested = false;
+    updateNextInput();
+}
+
+/*
+ * Copies the pages in written_pages back from parent, or clears them if
+ * parent is NULL, and marks them dirty. No pages are written afterwards.
+ */
+void DCPU16::restoreWrittenPages(const DCPU16 *parent)
+{
+    for(int i = 0; i < NUM_PAGES/32; i++)
+    {
+        for(uint32_t bits = written_pages[i]; bits; bits &= bits - 1)
+        {
+            uint32_t first = (i*32 + __builtin_ctz(bits)) << PAGE_SHIFT;
+
+            if(parent)
+            {
+                std::copy(parent->mem + first, parent->mem + first + PAGE_SIZE, mem + first);
+                std::copy(parent->mem_flags + first, parent->mem_flags + first + PAGE_SIZE, mem_flags + first);
+            }
+            else
+            {
+                std::fill(mem + first, mem + first + PAGE_SIZE, 0);
+                std::fill(mem_flags + first, mem_flags + first + PAGE_SIZE, 0);
+            }
+        }
+
+        dirty_pages[i] |= written_pages[i];
+        written_pages[i] = 0;
+    }
 }
 
 void DCPU16::loadProgram(const uint16_t *words, uint16_t num_words)
 {
     reset();
     std::copy(words, words+num_words, mem);
+    markDirty(0, num_words);
 }
 
+void DCPU16::step()
+{
+    step<NoHooks>();
+}
+
+/*
+ * Executes one instruction, reporting fetches, memory accesses and
+ * triggered interrupts to HOOKS. Only NoHooks, CallbackHooks and
+ * CoverageHooks are instantiated.
+ */
+template<class HOOKS>
 void DCPU16::step()
 {
     if(error)
         return;
 
-    if(interrupt_count > 0)
-        beginInterrupt(interrupt_queue[--interrupt_count]);
+    uint64_t start = clock;
 
-    InstructionData instruction = nextInstruction();
-    last_instruction = instruction;
+    if(clock >= next_service)
+        service<HOOKS>();
 
-    uint16_t op    = instruction.op;
-    uint16_t ob    = instruction.ob;
-    uint16_t a     = instruction.a;
-    uint16_t b     = instruction.b;
-    uint16_t *aptr = instruction.aptr;
-    uint16_t *bptr = instruction.bptr;
+    InstructionData &inst = last_instruction;
+    inst.instruction_address = pc;
+    inst.instruction         = mem[pc++];
+    HOOKS::onFetch(this, inst.instruction_address, inst.instruction);
 
-    /* true if a conditional fails. */
-    bool skip_next = false;
-
-    if(op != EXT)
-        doOpcode(op, a, b, bptr, &skip_next);
-    else if(ob != EXT)
-        doOpcodeExt0(ob, a, b, aptr);
-    else
-        setError(ERROR_OPCODE_INVALID);
-
-    clock += instruction.cycles;
+    /* true if a conditional fails. The handler adds the cycles. */
+    bool skip_next = Handlers<HOOKS>::table[inst.instruction](this, inst.instruction);
 
     if(skip_next)
-    {
-        nextInstruction();
-        clock += 2;
-    }
+        skipInstruction();
+
+    HOOKS::onStep(this, clock - start);
 }
 
-void DCPU16::doOpcode(uint16_t op, uint16_t a, uint16_t b, uint16_t *bptr, bool *skip_next)
+/*
+ * Executes basic operation OP on operand values a and b. Results are
+ * written to operand b through its accessor.
+ *
+ * @return true if the operation is a conditional that failed.
+ */
+template<class HOOKS, int OP, int B_MODE>
+bool DCPU16::doOpcode(uint16_t a, uint16_t b, const OperandInfo &b_info, uint16_t b_address)
 {
-    /* signed 64 bit values to perform intermediate operation with. */
-    int64_t a64 = a, b64 = b;
+    typedef Operand<B_MODE, OPERAND_SOURCE_B, HOOKS> B;
+
+    bool skip_next = false;
+    uint16_t next_ex;
+
     int16_t sa = a;
     int16_t sb = b;
 
-    switch(op)
+    /* EX is set after writing b, so an EX destination gets overwritten. */
+    switch(OP)
     {
     case SET: 
-        writePtr(bptr, a);
+        B::write(this, b_info, b_address, a);
         break;
 
     case ADD:
-        writePtr(bptr, b + a);
-        ex = b64 + a64 > 0xFFFF ? 0x0001 : 0x0000;
+        B::write(this, b_info, b_address, Arithmetic::add(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case SUB:
-        writePtr(bptr, b - a);
-        ex = b64 - a64 < 0 ? 0xFFFF : 0x0000;
+        B::write(this, b_info, b_address, Arithmetic::sub(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case MUL:
-        writePtr(bptr, b * a);
-        ex = ((b64 * a64) >> 16) & 0xFFFF;
+        B::write(this, b_info, b_address, Arithmetic::mul(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case MLI:
-        writePtr(bptr, sb * sa);
-        ex = ((b64 * a64) >> 16) & 0xFFFF;
+        B::write(this, b_info, b_address, Arithmetic::mli(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case DIV:
-        if(a == 0)
-        {
-            writePtr(bptr, 0);
-            ex = 0x0000;
-        }
-        else
-        {
-            writePtr(bptr, b / a);
-            ex = ((b64 << 16) / a64) & 0xFFFF;
-        }
+        B::write(this, b_info, b_address, Arithmetic::div(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case DVI:
-        if(a == 0)
-        {
-            writePtr(bptr, 0);
-            ex = 0x0000;
-        }
-        else
-        {
-            int16_t result = sb / sa;
-            result = result > 0 ? result : std::ceil(result);
-            writePtr(bptr, std::ceil(sb / sa));
-            ex = ((b64 << 16) / a64) & 0xFFFF;
-        }
+        B::write(this, b_info, b_address, Arithmetic::dvi(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case MOD:
-        writePtr(bptr, a == 0 ? 0 : b % a);
+        B::write(this, b_info, b_address, Arithmetic::mod(b, a));
         break;
 
     case MDI:
-        writePtr(bptr, a == 0 ? 0 : b - a * (b/a));
+        B::write(this, b_info, b_address, Arithmetic::mdi(b, a));
         break;
 
     case AND:
-        writePtr(bptr, b & a);
+        B::write(this, b_info, b_address, b & a);
         break;
 
     case BOR:
-        writePtr(bptr, b | a);
+        B::write(this, b_info, b_address, b | a);
         break;
 
     case XOR:
-        writePtr(bptr, b ^ a);
+        B::write(this, b_info, b_address, b ^ a);
         break;
 
     case SHR:
-        writePtr(bptr, b >> a);
-        ex = ((b64 << 16) >> a64) & 0xFFFF;
+        B::write(this, b_info, b_address, Arithmetic::shr(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case ASR:
-        writePtr(bptr, arithmeticShift(b, a));
-        ex = ((b64 << 16) >> a64) & 0xFFFF;
+        B::write(this, b_info, b_address, Arithmetic::asr(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case SHL:
-        writePtr(bptr, b << a);
-        ex = ((b64 << a64) >> 16) & 0xFFFF;
+        B::write(this, b_info, b_address, Arithmetic::shl(b, a, &next_ex));
+        ex = next_ex;
         break;
 
     case IFB:
-        *skip_next = !((b & a) != 0);
+        skip_next = !((b & a) != 0);
         break;
 
     case IFC:
-        *skip_next = !((b & a) == 0);
+        skip_next = !((b & a) == 0);
         break;
 
     case IFE:
-        *skip_next = !(b == a);
+        skip_next = !(b == a);
         break;
 
     case IFN:
-        *skip_next = !(b != a);
+        skip_next = !(b != a);
         break;
 
     case IFG:
-        *skip_next = !(b > a);
+        skip_next = !(b > a);
         break;
 
     case IFA:
-        *skip_next = !(sb > sa);
+        skip_next = !(sb > sa);
         break;
 
     case IFL:
-        *skip_next = !(b < a);
+        skip_next = !(b < a);
         break;
 
     case IFU:
-        *skip_next = !(sb < sa);
+        skip_next = !(sb < sa);
         break;
 
     case ADX:
-        writePtr(bptr, b + a + ex);
-        ex = b64 + a64 + ex > 0 ? 0x0001 : 0x0000;
+        B::write(this, b_info, b_address, Arithmetic::adx(b, a, ex, &next_ex));
+        ex = next_ex;
         break;
 
     case SBX:
-        writePtr(bptr, b - a + ex);
-        ex = b64 - a64 + ex < 0 ? 0xFFFF : 0x0000;
+        B::write(this, b_info, b_address, Arithmetic::sbx(b, a, ex, &next_ex));
+        ex = next_ex;
         break;
 
     case STI:
-        writePtr(bptr, a);
+        B::write(this, b_info, b_address, a);
         reg[REG_I]++;
         reg[REG_J]++;
         break;
 
     case STD:
-        writePtr(bptr, a);
+        B::write(this, b_info, b_address, a);
         reg[REG_I]--;
         reg[REG_J]--;
         break;
@@ -235,33 +756,32 @@ void DCPU16::doOpcode(uint16_t op, uint16_t a, uint16_t b, uint16_t *bptr, bool
         setError(ERROR_OPCODE_INVALID);
         break;
     }
+
+    return skip_next;
 }
 
-void DCPU16::doOpcodeExt0(uint16_t op, uint16_t a, uint16_t b, uint16_t *aptr)
+/*
+ * Executes special operation OP on operand value a. Results are written to
+ * operand a through its accessor.
+ */
+template<class HOOKS, int OP, int A_MODE>
+void DCPU16::doOpcodeExt0(uint16_t a, const OperandInfo &a_info, uint16_t a_address)
 {
-    switch(op)
+    typedef Operand<A_MODE, OPERAND_SOURCE_A, HOOKS> A;
+
+    switch(OP)
     {
     case JSR:
-        mem[--sp] = pc;
+        writeMemory<HOOKS>(--sp, pc);
         pc = a;
         break;
 
     case INT:
-        if(ia != 0 && interrupt_queueing)
-        {
-            if(interrupt_count == MAX_INTERRUPTS)
-                setError(ERROR_INTERRUPT_QUEUE_FULL);
-            else
-                interrupt_queue[interrupt_count++] = a;
-        }
-        else if(ia != 0)
-        {
-            beginInterrupt(a);
-        }
+        queueInterrupt(a);
         break;
 
     case IAG:
-        writePtr(aptr, ia);
+        A::write(this, a_info, a_address, ia);
         break;
 
     case IAS:
@@ -269,15 +789,15 @@ void DCPU16::doOpcodeExt0(uint16_t op, uint16_t a, uint16_t b, uint16_t *aptr)
         break;
 
     case RFI:
-        endInterrupt();
+        endInterrupt<HOOKS>();
         break;
 
     case IAQ:
-        interrupt_queueing = a == 0 ? false : true;
+        setInterruptQueueing(a != 0);
         break;
 
     case HWN:
-        writePtr(aptr, devices.size());
+        A::write(this, a_info, a_address, devices.size());
         break;
 
     case HWQ:
@@ -307,7 +827,10 @@ void DCPU16::doOpcodeExt0(uint16_t op, uint16_t a, uint16_t b, uint16_t *aptr)
 
     case HWI:
         if(a < devices.size())
-            devices[a].interrupt();
+        {
+            hardwareInterrupt(a);
+            HOOKS::onHardwareInterrupt(this, a);
+        }
         // TODO warn a is invalid
         break;
 
@@ -317,66 +840,345 @@ void DCPU16::doOpcodeExt0(uint16_t op, uint16_t a, uint16_t b, uint16_t *aptr)
     }
 }
 
-uint16_t DCPU16::arithmeticShift(uint16_t i, uint16_t s)
+/*
+ * Triggers an interrupt with the given message from a device or the host.
+ * The interrupt is recorded to the input log. While replaying, interrupts
+ * come from the log and calls to this are ignored.
+ */
+void DCPU16::interrupt(uint16_t msg)
+{
+    if(input_log)
+    {
+        if(input_log->getMode() == InputLog::MODE_REPLAY)
+            return;
+
+        InputLog::Entry entry;
+        entry.type  = InputLog::ENTRY_INTERRUPT;
+        entry.value = msg;
+        recordInput(&entry);
+    }
+
+    queueInterrupt(msg);
+}
+
+/*
+ * Interrupts are queued and the oldest one is triggered before the next
+ * instruction while queueing is disabled. Interrupts are ignored if no
+ * interrupt handler is set.
+ */
+void DCPU16::queueInterrupt(uint16_t msg)
 {
-    s = std::max(s, (uint16_t)16);
-    uint16_t r = i >> s;
+    if(ia == 0)
+        return;
 
-    if(i & 0x8000) /* MSB is set */
+    if(interrupt_count == MAX_INTERRUPTS)
     {
-        for(int i = 0; i < s; i++)
-            r = r | (1 << (15-i));
+        setError(ERROR_INTERRUPT_QUEUE_FULL);
+        return;
     }
 
-    return r;
+    interrupt_queue[(interrupt_head + interrupt_count) % MAX_INTERRUPTS] = msg;
+    interrupt_count++;
+    updatePending();
 }
 
+template<class HOOKS>
 void DCPU16::beginInterrupt(uint16_t msg)
 {
-    interrupt_queueing = true;
-    mem[sp--] = pc;
-    mem[sp--] = reg[REG_A];
+    setInterruptQueueing(true);
+    writeMemory<HOOKS>(--sp, pc);
+    writeMemory<HOOKS>(--sp, reg[REG_A]);
     pc = ia;
     reg[REG_A] = msg;
+    HOOKS::onInterrupt(this, msg);
 }
 
+template<class HOOKS>
 void DCPU16::endInterrupt()
 {
-    interrupt_queueing = false;
-    pc = mem[sp++];
-    reg[REG_A] = mem[sp++];
+    setInterruptQueueing(false);
+    reg[REG_A] = readMemory<HOOKS>(sp++);
+    pc = readMemory<HOOKS>(sp++);
 }
 
+void DCPU16::setInterruptQueueing(bool queueing)
+{
+    interrupt_queueing = queueing;
+    updatePending();
+}
+
+void DCPU16::updatePending()
+{
+    interrupt_pending = interrupt_count > 0 && !interrupt_queueing;
+    next_service = interrupt_pending ? 0 : std::min(next_event, next_input);
+}
 
 /*
- * Reads the next instruction, processes its operands, and advances the program
- * counter.
- *
- * Note: No cycles are added.
+ * Replays due input, runs due device events and triggers at most one queued
+ * interrupt. Called from step() between instructions.
  */
-InstructionData DCPU16::nextInstruction()
+template<class HOOKS>
+void DCPU16::service()
 {
-    InstructionData data;
+    if(clock >= next_input)
+        replayInput();
 
-    data.instruction_address = pc;
-    data.instruction         = mem[pc++];
-    data.cycles              = getInstructionCycles(data.instruction);
-    splitInstruction(data.instruction, &data.op, &data.oa, &data.ob);
+    if(clock >= next_event)
+        processEvents();
 
-
-    if(data.op != EXT)
+    if(interrupt_pending)
     {
-        processOperand(data.oa, &data.aptr, &data.a, OPERAND_SOURCE_A);
-        processOperand(data.ob, &data.bptr, &data.b, OPERAND_SOURCE_B);
+        uint16_t msg = interrupt_queue[interrupt_head];
+        interrupt_head = (interrupt_head + 1) % MAX_INTERRUPTS;
+        interrupt_count--;
+
+        /* the handler may have been removed since the interrupt was queued. */
+        if(ia != 0)
+            beginInterrupt<HOOKS>(msg);
     }
-    else
+
+    updatePending();
+}
+
+/*
+ * Executes basic operation OP with operands in modes A_MODE and B_MODE.
+ * Operand a is resolved before operand b, so next words are read in that
+ * order. Operand b is only read by operations that use its value. The instruction's cycles are added once it completed, after any
+ * cycles HWI added.
+ */
+template<class HOOKS, int OP, int A_MODE, int B_MODE>
+bool DCPU16::executeBasic(DCPU16 *cpu, uint16_t instruction)
+{
+    typedef Operand<A_MODE, OPERAND_SOURCE_A, HOOKS> A;
+    typedef Operand<B_MODE, OPERAND_SOURCE_B, HOOKS> B;
+
+    const OperandInfo &a_info = operands[(instruction & INST_VA_MASK) >> INST_VA_SHIFT];
+    const OperandInfo &b_info = operands[(instruction & INST_VB_MASK) >> INST_VB_SHIFT];
+
+    uint16_t a_address = A::resolve(cpu, a_info);
+    uint16_t a         = A::read(cpu, a_info, a_address);
+    uint16_t b_address = B::resolve(cpu, b_info);
+
+    /* SET, STI and STD only write b, so b isn't read and counted as a read. */
+    bool write_only    = OP == SET || OP == STI || OP == STD;
+    uint16_t b         = write_only ? 0 : B::read(cpu, b_info, b_address);
+
+    bool skip_next = cpu->doOpcode<HOOKS, OP, B_MODE>(a, b, b_info, b_address);
+
+    /* the table is constant and OP a template argument, so this is one add. */
+    cpu->clock += basic_operations[OP].cycles + A::CYCLES + B::CYCLES;
+    return skip_next;
+}
+
+/*
+ * Executes special operation OP with its operand in mode A_MODE.
+ */
+template<class HOOKS, int OP, int A_MODE>
+bool DCPU16::executeSpecial(DCPU16 *cpu, uint16_t instruction)
+{
+    typedef Operand<A_MODE, OPERAND_SOURCE_A, HOOKS> A;
+
+    const OperandInfo &a_info = operands[(instruction & INST_VA_MASK) >> INST_VA_SHIFT];
+
+    uint16_t a_address = A::resolve(cpu, a_info);
+    uint16_t a         = A::read(cpu, a_info, a_address);
+
+    cpu->doOpcodeExt0<HOOKS, OP, A_MODE>(a, a_info, a_address);
+
+    cpu->clock += special_operations[OP].cycles + A::CYCLES;
+    return false;
+}
+
+/*
+ * Handler tables indexed by operation and operand modes. Invalid operations
+ * share the handlers of one invalid opcode, which resolve the operands like
+ * any other instruction and then set ERROR_OPCODE_INVALID. Operand b is
+ * never a short literal, so its MODE_LITERAL column repeats the
+ * MODE_NEXT_WORD_LITERAL handlers instead of instantiating unused ones.
+ */
+#define BASIC_B(op, a) {                                                      \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_REGISTER>,               \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_REGISTER_PTR>,           \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_REGISTER_NEXT_WORD_PTR>, \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_PUSH_POP>,               \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_PEEK>,                   \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_PICK>,                   \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_SP>,                     \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_PC>,                     \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_EX>,                     \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_NEXT_WORD_PTR>,          \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_NEXT_WORD_LITERAL>,      \
+    &DCPU16::executeBasic<HOOKS, op, a, DCPU16::MODE_NEXT_WORD_LITERAL>,      \
+}
+
+#define BASIC(op) {                                                           \
+    BASIC_B(op, DCPU16::MODE_REGISTER),                                       \
+    BASIC_B(op, DCPU16::MODE_REGISTER_PTR),                                   \
+    BASIC_B(op, DCPU16::MODE_REGISTER_NEXT_WORD_PTR),                         \
+    BASIC_B(op, DCPU16::MODE_PUSH_POP),                                       \
+    BASIC_B(op, DCPU16::MODE_PEEK),                                           \
+    BASIC_B(op, DCPU16::MODE_PICK),                                           \
+    BASIC_B(op, DCPU16::MODE_SP),                                             \
+    BASIC_B(op, DCPU16::MODE_PC),                                             \
+    BASIC_B(op, DCPU16::MODE_EX),                                             \
+    BASIC_B(op, DCPU16::MODE_NEXT_WORD_PTR),                                  \
+    BASIC_B(op, DCPU16::MODE_NEXT_WORD_LITERAL),                              \
+    BASIC_B(op, DCPU16::MODE_LITERAL),                                        \
+}
+
+#define SPECIAL(op) {                                                         \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_REGISTER>,                \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_REGISTER_PTR>,            \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_REGISTER_NEXT_WORD_PTR>,  \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_PUSH_POP>,                \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_PEEK>,                    \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_PICK>,                    \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_SP>,                      \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_PC>,                      \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_EX>,                      \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_NEXT_WORD_PTR>,           \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_NEXT_WORD_LITERAL>,       \
+    &DCPU16::executeSpecial<HOOKS, op, DCPU16::MODE_LITERAL>,                 \
+}
+
+#define INVALID_BASIC   BASIC(0x18)
+#define INVALID_SPECIAL SPECIAL(0x00)
+
+template<class HOOKS>
+const DCPU16::Handler DCPU16::Handlers<HOOKS>::basic[NUM_OPERATIONS][NUM_MODES][NUM_MODES] = {
+    /* 0x00 */ INVALID_BASIC,
+    /* 0x01 */ BASIC(SET),
+    /* 0x02 */ BASIC(ADD),
+    /* 0x03 */ BASIC(SUB),
+    /* 0x04 */ BASIC(MUL),
+    /* 0x05 */ BASIC(MLI),
+    /* 0x06 */ BASIC(DIV),
+    /* 0x07 */ BASIC(DVI),
+    /* 0x08 */ BASIC(MOD),
+    /* 0x09 */ BASIC(MDI),
+    /* 0x0A */ BASIC(AND),
+    /* 0x0B */ BASIC(BOR),
+    /* 0x0C */ BASIC(XOR),
+    /* 0x0D */ BASIC(SHR),
+    /* 0x0E */ BASIC(ASR),
+    /* 0x0F */ BASIC(SHL),
+    /* 0x10 */ BASIC(IFB),
+    /* 0x11 */ BASIC(IFC),
+    /* 0x12 */ BASIC(IFE),
+    /* 0x13 */ BASIC(IFN),
+    /* 0x14 */ BASIC(IFG),
+    /* 0x15 */ BASIC(IFA),
+    /* 0x16 */ BASIC(IFL),
+    /* 0x17 */ BASIC(IFU),
+    /* 0x18 */ INVALID_BASIC,
+    /* 0x19 */ INVALID_BASIC,
+    /* 0x1A */ BASIC(ADX),
+    /* 0x1B */ BASIC(SBX),
+    /* 0x1C */ INVALID_BASIC,
+    /* 0x1D */ INVALID_BASIC,
+    /* 0x1E */ BASIC(STI),
+    /* 0x1F */ BASIC(STD),
+};
+
+template<class HOOKS>
+const DCPU16::Handler DCPU16::Handlers<HOOKS>::special[NUM_OPERATIONS][NUM_MODES] = {
+    /* 0x00 */ INVALID_SPECIAL,
+    /* 0x01 */ SPECIAL(JSR),
+    /* 0x02 */ INVALID_SPECIAL,
+    /* 0x03 */ INVALID_SPECIAL,
+    /* 0x04 */ INVALID_SPECIAL,
+    /* 0x05 */ INVALID_SPECIAL,
+    /* 0x06 */ INVALID_SPECIAL,
+    /* 0x07 */ INVALID_SPECIAL,
+    /* 0x08 */ SPECIAL(INT),
+    /* 0x09 */ SPECIAL(IAG),
+    /* 0x0A */ SPECIAL(IAS),
+    /* 0x0B */ SPECIAL(RFI),
+    /* 0x0C */ SPECIAL(IAQ),
+    /* 0x0D */ INVALID_SPECIAL,
+    /* 0x0E */ INVALID_SPECIAL,
+    /* 0x0F */ INVALID_SPECIAL,
+    /* 0x10 */ SPECIAL(HWN),
+    /* 0x11 */ SPECIAL(HWQ),
+    /* 0x12 */ SPECIAL(HWI),
+    /* 0x13 */ INVALID_SPECIAL,
+    /* 0x14 */ INVALID_SPECIAL,
+    /* 0x15 */ INVALID_SPECIAL,
+    /* 0x16 */ INVALID_SPECIAL,
+    /* 0x17 */ INVALID_SPECIAL,
+    /* 0x18 */ INVALID_SPECIAL,
+    /* 0x19 */ INVALID_SPECIAL,
+    /* 0x1A */ INVALID_SPECIAL,
+    /* 0x1B */ INVALID_SPECIAL,
+    /* 0x1C */ INVALID_SPECIAL,
+    /* 0x1D */ INVALID_SPECIAL,
+    /* 0x1E */ INVALID_SPECIAL,
+    /* 0x1F */ INVALID_SPECIAL,
+};
+
+#undef INVALID_SPECIAL
+#undef INVALID_BASIC
+#undef SPECIAL
+#undef BASIC
+#undef BASIC_B
+
+template<class HOOKS>
+DCPU16::Handler DCPU16::Handlers<HOOKS>::table[NUM_INSTRUCTIONS];
+
+template<class HOOKS>
+const bool DCPU16::Handlers<HOOKS>::built = DCPU16::Handlers<HOOKS>::build();
+
+/*
+ * Fills the handler of every instruction word. Runs during static
+ * initialization, so cpus must not be stepped from other static
+ * constructors.
+ */
+template<class HOOKS>
+bool DCPU16::Handlers<HOOKS>::build()
+{
+    for(uint32_t i = 0; i < NUM_INSTRUCTIONS; i++)
     {
-        data.a = 0;
-        data.aptr = NULL;
-        processOperand(data.ob, &data.bptr, &data.b, OPERAND_SOURCE_B);
+        uint16_t op, oa, ob;
+        op = (i & INST_OP_MASK) >> INST_OP_SHIFT;
+        oa = (i & INST_VA_MASK) >> INST_VA_SHIFT;
+        ob = (i & INST_VB_MASK) >> INST_VB_SHIFT;
+
+        if(op != EXT)
+            table[i] = basic[op][operands[oa].mode][operands[ob].mode];
+        else
+            table[i] = special[ob][operands[oa].mode];
     }
 
-    return data;
+    return true;
+}
+
+/*
+ * The hook policies the cpu is built with. Instantiating Handlers also
+ * defines its built flag, which is what fills the table.
+ */
+template struct DCPU16::Handlers<DCPU16::NoHooks>;
+template struct DCPU16::Handlers<DCPU16::CallbackHooks>;
+template struct DCPU16::Handlers<DCPU16::CoverageHooks>;
+template void DCPU16::step<DCPU16::NoHooks>();
+template void DCPU16::step<DCPU16::CallbackHooks>();
+template void DCPU16::step<DCPU16::CoverageHooks>();
+
+/*
+ * Skips the next instruction without processing its operands. Conditional
+ * instructions are skipped along with the instruction following them.
+ * Each skipped instruction takes one cycle.
+ */
+void DCPU16::skipInstruction()
+{
+    bool conditional;
+
+    do
+    {
+        uint16_t instruction = mem[pc];
+        conditional = getOperationInfo(instruction).flags & OPERATION_CONDITIONAL;
+        pc += getInstructionLength(instruction);
+        clock += 1;
+    } while(conditional);
 }
 
 void DCPU16::splitInstruction(uint16_t instruction, uint16_t *op, uint16_t *oa, uint16_t *ob) const
@@ -386,43 +1188,44 @@ void DCPU16::splitInstruction(uint16_t instruction, uint16_t *op, uint16_t *oa,
     *ob = (instruction & INST_VB_MASK) >> INST_VB_SHIFT;
 }
 
-void DCPU16::processOperand(uint16_t operand, uint16_t **ptr, uint16_t *value, char source)
+/*
+ * @param instruction Instruction to look up.
+ *
+ * @return The basic or special operation the instruction encodes.
+ */
+const OperationInfo& DCPU16::getOperationInfo(uint16_t instruction)
 {
-    /*
-     * When indexing registers it's possible to compute the index as (operand %
-     * NUM_REGISTERS). This works since register indices are aligned to
-     * NUM_REGISTERS boundaries.
-     */
+    uint16_t op = (instruction & INST_OP_MASK) >> INST_OP_SHIFT;
+
+    if(op != EXT)
+        return basic_operations[op];
+    return special_operations[(instruction & INST_VB_MASK) >> INST_VB_SHIFT];
+}
+
+/*
+ * @param operand Operand extracted from an instruction.
+ */
+const OperandInfo& DCPU16::getOperandInfo(uint16_t operand)
+{
+    return operands[operand % NUM_OPERANDS];
+}
+
+/*
+ * @param instruction Instruction to get the length of.
+ *
+ * @return The number of words the instruction and its operands take.
+ */
+int DCPU16::getInstructionLength(uint16_t instruction)
+{
+    uint16_t op = (instruction & INST_OP_MASK) >> INST_OP_SHIFT;
+    uint16_t oa = (instruction & INST_VA_MASK) >> INST_VA_SHIFT;
+    uint16_t ob = (instruction & INST_VB_MASK) >> INST_VB_SHIFT;
 
-    *ptr = NULL;
-
-    if(operand <= OPERAND_REGISTER)
-        *ptr = reg + operand;
-    else if(operand <= OPERAND_REGISTER_PTR)
-        *ptr = mem + reg[operand % NUM_REGISTERS];
-    else if(operand <= OPERAND_REGISTER_NEXT_WORD_PTR)
-        *ptr = mem + mem[pc++] + reg[operand % NUM_REGISTERS];
-    else if(OPERAND_PUSH_POP == operand && OPERAND_SOURCE_A == source) // POP
-        *ptr = mem + sp++;
-    else if(OPERAND_PUSH_POP == operand && OPERAND_SOURCE_B == source) // PUSH
-        *ptr = mem + --sp;
-    else if(OPERAND_PEEK == operand)
-        *ptr = mem + sp;
-    else if(OPERAND_SP == operand)
-        *ptr = &sp;
-    else if(OPERAND_PC == operand)
-        *ptr = &pc;
-    else if(OPERAND_EX == operand)
-        *ptr = &ex;
-    else if(OPERAND_NEXT_WORD_PTR == operand)
-        *ptr = mem + mem[pc++];
-    else if(OPERAND_NEXT_WORD_LITERAL == operand)
-        *value = mem[pc++];
-    else
-        /* literals in the range [-1, 30] */
-        *value = operand - OPERAND_LITERAL - 1;
-
-    if(*ptr) *value = **ptr;
+    int length = 1 + operands[oa].next_word;
+    if(op != EXT)
+        length += operands[ob].next_word;
+
+    return length;
 }
 
 /*
@@ -439,8 +1242,8 @@ int DCPU16::getInstructionCycles(uint16_t instruction) const
     splitInstruction(instruction, &op, &oa, &ob);
 
     int cycles = getOperationCycles(instruction);
-    cycles    += getOperationCycles(ob);
-    cycles    += op == EXT ? 0 : getOperandCycles(oa);
+    cycles    += getOperandCycles(oa);
+    cycles    += op == EXT ? 0 : getOperandCycles(ob);
 
     return cycles;
 }
@@ -452,110 +1255,309 @@ int DCPU16::getInstructionCycles(uint16_t instruction) const
  */
 int DCPU16::getOperationCycles(uint16_t instruction) const
 {
-    uint16_t op, oa, ob;
-    splitInstruction(instruction, &op, &oa, &ob);
+    return getOperationInfo(instruction).cycles;
+}
 
-    if(op != EXT)
+/*
+ * @param operand Operand extracted from an instruction.
+ *
+ * @return The number of cycles the operand takes.
+ */
+int DCPU16::getOperandCycles(uint16_t operand) const
+{
+    return getOperandInfo(operand).cycles;
+}
+
+/*
+ * Reads a word for an operand, counting the access.
+ */
+template<class HOOKS>
+inline uint16_t DCPU16::readMemory(uint16_t addr)
+{
+    HOOKS::onRead(this, addr, mem[addr]);
+    return mem[addr];
+}
+
+template<class HOOKS>
+inline void DCPU16::writeMemory(uint16_t addr, uint16_t value)
+{
+    //TODO check memory flags
+    noteWrite(addr);
+    mem[addr] = value;
+    HOOKS::onWrite(this, addr, value);
+}
+
+bool DCPU16::attachDevice(Device device, uint16_t *device_id)
+{
+    if(devices.size() >= MAX_DEVICES)
+        return false;
+
+    devices.push_back(device);
+    *device_id = uint16_t(devices.size() - 1);
+    return true;
+}
+
+/*
+ * Detaches all devices and drops the events they scheduled.
+ */
+void DCPU16::detachAllDevices()
+{
+    devices.clear();
+    events.clear();
+    next_event = UINT64_MAX;
+    updatePending();
+}
+
+static bool eventLater(const DeviceEvent &a, const DeviceEvent &b)
+{
+    return a.cycle > b.cycle;
+}
+
+/*
+ * Schedules a device callback to run once the given number of cycles have
+ * passed. Events run between instructions once the clock reaches their cycle.
+ *
+ * @param cycles    Cycles from now until the callback runs.
+ * @param callback  Function to call.
+ * @param data      Passed to the callback. Also used to cancel events.
+ */
+void DCPU16::scheduleEvent(uint64_t cycles, void (*callback)(DCPU16*, void*), void *data)
+{
+    DeviceEvent event;
+    event.cycle    = clock + cycles;
+    event.callback = callback;
+    event.data     = data;
+
+    events.push_back(event);
+    std::push_heap(events.begin(), events.end(), eventLater);
+    next_event = events.front().cycle;
+    updatePending();
+}
+
+/*
+ * Removes all pending events scheduled with the given data pointer.
+ */
+void DCPU16::cancelEvents(void *data)
+{
+    size_t n = 0;
+
+    for(size_t i = 0; i < events.size(); i++)
+        if(events[i].data != data)
+            events[n++] = events[i];
+
+    events.resize(n);
+    std::make_heap(events.begin(), events.end(), eventLater);
+    next_event = events.empty() ? UINT64_MAX : events.front().cycle;
+    updatePending();
+}
+
+void DCPU16::processEvents()
+{
+    while(!events.empty() && events.front().cycle <= clock)
+    {
+        DeviceEvent event = events.front();
+        std::pop_heap(events.begin(), events.end(), eventLater);
+        events.pop_back();
+
+        /* the callback may schedule more events. */
+        next_event = events.empty() ? UINT64_MAX : events.front().cycle;
+        event.callback(this, event.data);
+    }
+}
+
+/*
+ * Sends HWI to a device. While recording, the registers the device changed
+ * and its extra cycles are logged after any input it delivered. While
+ * replaying, they are taken from the log and the device isn't called.
+ */
+void DCPU16::hardwareInterrupt(uint16_t device)
+{
+    if(input_log && input_log->getMode() == InputLog::MODE_REPLAY)
+    {
+        replayHardwareInterrupt(device);
+        return;
+    }
+
+    uint16_t before[NUM_REGISTERS];
+    std::copy(reg, reg + NUM_REGISTERS, before);
+
+    input_nested = true;
+    int cycles = devices[device].interrupt(this, devices[device].data);
+    input_nested = false;
+
+    if(input_log)
     {
-        switch(op)
+        InputLog::Entry entry;
+        entry.type     = InputLog::ENTRY_HWI;
+        entry.value    = device;
+        entry.count    = cycles;
+        entry.reg_mask = 0;
+
+        for(int i = 0; i < NUM_REGISTERS; i++)
         {
-            case SET: return 1;
-            case ADD: return 2;
-            case SUB: return 2;
-            case MUL: return 2;
-            case MLI: return 2;
-            case DIV: return 3;
-            case DVI: return 3;
-            case MOD: return 3;
-            case MDI: return 3;
-            case AND: return 1;
-            case BOR: return 1;
-            case XOR: return 1;
-            case SHR: return 1;
-            case ASR: return 1;
-            case SHL: return 1;
-            case IFB: return 2;
-            case IFC: return 2;
-            case IFE: return 2;
-            case IFN: return 2;
-            case IFG: return 2;
-            case IFA: return 2;
-            case IFL: return 2;
-            case IFU: return 2;
-            case ADX: return 3;
-            case SBX: return 3;
-            case STI: return 2;
-            case STD: return 2;
-            default:  break;
+            if(reg[i] != before[i])
+            {
+                entry.reg_mask |= 1 << i;
+                entry.reg[i] = reg[i];
+            }
         }
+
+        recordInput(&entry);
     }
-    else if(ob != EXT)
+
+    clock += cycles;
+}
+
+/*
+ * Copies count words a device delivers into memory at addr, wrapping around
+ * the end of memory. Devices write memory through this so the words are
+ * recorded to the input log. While replaying, the words come from the log
+ * and calls to this are ignored.
+ */
+void DCPU16::deviceWrite(uint16_t addr, const uint16_t *words, uint32_t count)
+{
+    count = std::min<uint32_t>(count, MEMORY_SIZE);
+
+    if(input_log)
     {
-        switch(ob)
+        if(input_log->getMode() == InputLog::MODE_REPLAY)
+            return;
+
+        std::vector<uint8_t> bytes(count * 2);
+        for(uint32_t i = 0; i < count; i++)
         {
-            case JSR: return 3;
-            case INT: return 4;
-            case IAG: return 1;
-            case IAS: return 1;
-            case RFI: return 3;
-            case IAQ: return 2;
-            case HWN: return 2;
-            case HWQ: return 4;
-            case HWI: return 4;
-            default:  break;
+            bytes[i*2]     = uint8_t(words[i]);
+            bytes[i*2 + 1] = uint8_t(words[i] >> 8);
         }
+
+        InputLog::Entry entry;
+        entry.type  = InputLog::ENTRY_MEMORY;
+        entry.value = addr;
+        entry.count = count;
+        entry.words = bytes.empty() ? NULL : &bytes[0];
+        recordInput(&entry);
     }
 
-    return 0;
+    copyWords(mem, addr, words, count);
+    markDirty(addr, count);
 }
 
 /*
- * @param operand Operand extracted from an instruction.
- *
- * @return The number of cycles the operand takes.
+ * Starts recording input to log or replaying input from it, or stops if log
+ * is NULL. The log is used from input_position on, so a cpu restored from a
+ * copy carries on from where the copy was in the log. When recording,
+ * entries past that point are dropped.
  */
-int DCPU16::getOperandCycles(uint16_t operand) const
+void DCPU16::setInputLog(InputLog *log)
 {
-    if(OPERAND_REGISTER_PTR < operand && operand <= OPERAND_REGISTER_NEXT_WORD_PTR)
-        return 1;
-    if(OPERAND_NEXT_WORD_PTR == operand)
-        return 1;
-    if(OPERAND_LITERAL == operand)
-        return 1;
-    return 0;
+    input_log = log;
+
+    if(log && log->getMode() == InputLog::MODE_RECORD)
+        log->truncate(input_position);
+
+    updateNextInput();
 }
 
-bool DCPU16::writePtr(uint16_t *ptr, uint16_t value)
+void DCPU16::recordInput(InputLog::Entry *entry)
 {
-    if(!ptr)
+    entry->clock = clock;
+    if(input_nested)
+        entry->type |= InputLog::ENTRY_NESTED;
+
+    input_log->append(*entry);
+    input_position = input_log->size();
+}
+
+/*
+ * Delivers the logged input due by the current clock, stopping at input
+ * that belongs to an HWI.
+ */
+void DCPU16::replayInput()
+{
+    InputLog::Entry entry;
+    size_t next = input_position;
+
+    while(input_log->read(&next, &entry) && entry.clock <= clock &&
+          entry.type != InputLog::ENTRY_HWI && !(entry.type & InputLog::ENTRY_NESTED))
     {
-        //silently fail
-        //TODO print warning?
-        return false;
+        applyInput(entry);
+        input_position = next;
+    }
+
+    updateNextInput();
+}
+
+/*
+ * Replays HWI from the log. The next entries must be this HWI at the
+ * current clock, preceded by whatever input the device delivered while
+ * handling it.
+ */
+void DCPU16::replayHardwareInterrupt(uint16_t device)
+{
+    InputLog::Entry entry;
+    size_t next = input_position;
+    bool found;
+
+    while((found = input_log->read(&next, &entry)) && entry.clock == clock &&
+          (entry.type & InputLog::ENTRY_NESTED))
+    {
+        applyInput(entry);
+        input_position = next;
     }
 
-    if(mem <= ptr && ptr < mem + MEMORY_SIZE)
+    if(!found || entry.clock != clock || entry.type != InputLog::ENTRY_HWI || entry.value != device)
     {
-        //TODO check memory flags
+        setError(ERROR_REPLAY_MISMATCH);
+        return;
     }
 
-    *ptr = value;
-    return true;
+    for(int i = 0; i < NUM_REGISTERS; i++)
+        if(entry.reg_mask & (1 << i))
+            reg[i] = entry.reg[i];
+
+    clock += entry.count;
+    input_position = next;
+    updateNextInput();
 }
 
-bool DCPU16::attachDevice(Device device, uint16_t *device_id)
+void DCPU16::applyInput(const InputLog::Entry &entry)
 {
-    if(devices.size() >= MAX_DEVICES)
-        return false;
+    switch(entry.type & InputLog::ENTRY_TYPE_MASK)
+    {
+    case InputLog::ENTRY_INTERRUPT:
+        queueInterrupt(entry.value);
+        break;
 
-    devices.push_back(device);
-    *device_id = uint16_t(devices.size() - 1);
-    return true;
+    case InputLog::ENTRY_MEMORY:
+    {
+        std::vector<uint16_t> words(entry.count);
+        for(uint32_t i = 0; i < entry.count; i++)
+            words[i] = uint16_t(entry.words[i*2] | (entry.words[i*2 + 1] << 8));
+
+        copyWords(mem, entry.value, words.empty() ? NULL : &words[0], entry.count);
+        markDirty(entry.value, entry.count);
+        break;
+    }
+    }
 }
 
-void DCPU16::detachAllDevices()
+/*
+ * Caches the clock of the next input replayInput() delivers. Input that
+ * belongs to an HWI waits for the instruction instead.
+ */
+void DCPU16::updateNextInput()
 {
-    devices.clear();
+    InputLog::Entry entry;
+    size_t next = input_position;
+
+    next_input = UINT64_MAX;
+
+    if(input_log && input_log->getMode() == InputLog::MODE_REPLAY &&
+       input_log->read(&next, &entry) && entry.type != InputLog::ENTRY_HWI &&
+       !(entry.type & InputLog::ENTRY_NESTED))
+        next_input = entry.clock;
+
+    updatePending();
 }
 
 int DCPU16::getError() const
@@ -563,7 +1565,7 @@ int DCPU16::getError() const
     return error;
 }
 
-const char* DCPU16::getErrorString(int err) const
+const char* DCPU16::getErrorString(int err)
 {
     switch(err)
     {
@@ -572,17 +1574,31 @@ const char* DCPU16::getErrorString(int err) const
         case ERROR_STACK_UNDERFLOW:         return "ERROR_STACK_UNDERFLOW";
         case ERROR_OPCODE_INVALID:          return "ERROR_OPCODE_INVALID";
         case ERROR_INTERRUPT_QUEUE_FULL:    return "ERROR_INTERRUPT_QUEUE_FULL";
+        case ERROR_REPLAY_MISMATCH:         return "ERROR_REPLAY_MISMATCH";
         default: break;
     }
 
     return "UNKNOWN";
 }
 
+/*
+ * Turns printing errors to stdout on or off, for callers that report the
+ * errors themselves. Like the hooks, the setting survives reset() and fork().
+ */
+void DCPU16::setErrorPrinting(bool print)
+{
+    print_errors = print;
+}
+
 void DCPU16::setError(int err)
 {
     //TODO print info to print object thing?
     error = err;
-    std::cout << getErrorString(error);
+    if(print_errors)
+        std::cout << getErrorString(error);
+
+    if(stats && err < RuntimeStats::MAX_ERRORS)
+        RuntimeStats::add(&stats->errors[err], 1);
 }
 
 uint16_t DCPU16::read(uint32_t addr) const
@@ -612,19 +1628,19 @@ uint16_t DCPU16::read(uint32_t addr) const
 void DCPU16::write(uint32_t addr, uint16_t value) 
 {
     if(addr < MEMORY_SIZE)
-        mem[addr] = value;
+        writeMemory<NoHooks>(addr, value);
     else if(RW_REGISTER_0 <= addr && addr <= RW_REGISTER_7)
         reg[addr - RW_REGISTER_0] = value;
     else if(RW_REGISTER_PTR_0 <= addr && addr <= RW_REGISTER_PTR_7)
-        mem[reg[addr - RW_REGISTER_PTR_0]] = value;
+        writeMemory<NoHooks>(reg[addr - RW_REGISTER_PTR_0], value);
     else if(RW_PROGRAM_COUNTER == addr)
         pc = value;
     else if(RW_PROGRAM_COUNTER_PTR == addr)
-        mem[pc] = value;
+        writeMemory<NoHooks>(pc, value);
     else if(RW_STACK_POINTER == addr)
         sp = value;
     else if(RW_STACK_POINTER_PTR == addr)
-        mem[sp] = value;
+        writeMemory<NoHooks>(sp, value);
     else if(RW_EXCESS == addr)
         ex = value;
     else if(RW_INTERRUPT_ADDRESS == addr)
@@ -636,6 +1652,87 @@ const uint16_t* DCPU16::memoryPointer() const
     return mem;
 }
 
+/*
+ * Marks the word's page dirty and written.
+ */
+void DCPU16::noteWrite(uint16_t addr)
+{
+    uint32_t page = addr >> PAGE_SHIFT;
+    dirty_pages[page / 32] |= 1u << (page % 32);
+    written_pages[page / 32] |= 1u << (page % 32);
+}
+
+/*
+ * Marks the pages of count words starting at addr as written. Ranges wrap
+ * around the end of memory. Anything writing to mem directly must mark what
+ * it wrote, since reset() and fork() only restore the pages marked.
+ */
+void DCPU16::markDirty(uint16_t addr, uint32_t count)
+{
+    if(count == 0)
+        return;
+
+    uint32_t first = addr >> PAGE_SHIFT;
+    uint32_t num_pages = ((addr & (PAGE_SIZE - 1)) + count + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    num_pages = std::min<uint32_t>(num_pages, NUM_PAGES);
+
+    for(uint32_t i = 0; i < num_pages; i++)
+    {
+        uint32_t page = (first + i) % NUM_PAGES;
+        dirty_pages[page / 32] |= 1u << (page % 32);
+        written_pages[page / 32] |= 1u << (page % 32);
+    }
+}
+
+bool DCPU16::isPageDirty(int page) const
+{
+    return (dirty_pages[page / 32] >> (page % 32)) & 1;
+}
+
+void DCPU16::clearDirtyPages()
+{
+    std::fill(dirty_pages, dirty_pages + NUM_PAGES/32, 0);
+}
+
+/*
+ * Starts counting accesses into counters, or stops if counters is NULL. The
+ * counters are not owned by the cpu and are left as they are. Only
+ * step<CallbackHooks>() counts.
+ */
+void DCPU16::setAccessCounters(AccessCounters *counters)
+{
+    access_counters = counters;
+}
+
+/*
+ * Starts updating stats as the cpu runs, or stops if stats is NULL. The
+ * counters keep counting across resets. Only step<CallbackHooks>() updates
+ * them, except for the error counts which setError() always updates.
+ */
+void DCPU16::setStats(RuntimeStats *stats)
+{
+    this->stats = stats;
+}
+
+/*
+ * Attaches the callbacks step<CallbackHooks>() makes, or detaches them if
+ * hooks is NULL. step() never calls them.
+ */
+void DCPU16::setHooks(const ExecutionHooks *hooks)
+{
+    this->hooks = hooks;
+}
+
+/*
+ * Attaches the edge coverage step<CoverageHooks>() counts into, or
+ * detaches it if coverage is NULL. The coverage is not owned by the cpu.
+ */
+void DCPU16::setCoverage(EdgeCoverage *coverage)
+{
+    this->coverage = coverage;
+}
+
 uint64_t DCPU16::getCycles() const
 {
     return clock;
@@ -9,6 +9,7 @@
 
 #include <vector>
 #include "../library/pstdint.h"
+#include "input_log.h"
 
 
 struct InstructionData
@@ -23,49 +24,205 @@ struct InstructionData
     uint16_t instruction;
 
     /*
-     * Address of the instruction in the cpu's memory.
+     * Address of the instruction in the cpu's memory. The operation,
+     * operands and cycles aren't stored, DCPU16::splitInstruction() and
+     * getInstructionCycles() derive them from the instruction.
      */
     uint16_t instruction_address;
 
+
+    InstructionData();
+};
+
+/*
+ * Static description of an operation. Names are NULL for invalid opcodes.
+ */
+struct OperationInfo
+{
+    const char *name;
+    uint8_t     cycles;
+    uint8_t     flags;
+};
+
+/*
+ * Static description of an operand value. mode is one of the
+ * DCPU16::MODE_* constants and selects how the operand is resolved. reg is
+ * the register index for register modes and literal the value of short
+ * literals.
+ */
+struct OperandInfo
+{
+    uint8_t     mode;
+    uint8_t     reg;
+    uint8_t     cycles;
+    uint8_t     next_word;
+    uint16_t    literal;
+};
+
+class DCPU16;
+
+struct Device
+{
+    uint32_t (*getHardwareID)();
+    uint16_t (*getHardwareVersion)();
+    uint32_t (*getManufacturerID)();
+
     /*
-     * Operation and two operands extracted from the instruction.
+     * Called when the cpu executes HWI on the device. Returns the number of
+     * extra cycles the interrupt took.
      */
-    uint16_t op, oa, ob;
+    int      (*interrupt)(DCPU16 *dcpu, void *data);
 
     /*
-     * Value each operand resolves to. These can be:
-     * - A literal encoded in the operand.
-     * - A literal appearing in the words after the instruction.
-     * - A value in the cpu's memory.
-     * - A register.
-     * - The stack pointer.
-     * - The program counter.
-     * - Overflow.
-     * - Undefined if the operand is an extended instruction.
-     *
-     * If the value is writable a pointer is set to its memory location (in
-     * real memory), or NULL otherwise.
+     * Called when the cpu is reset. May be NULL.
      */
-    uint16_t a, *aptr, b, *bptr;
+    void     (*reset)(DCPU16 *dcpu, void *data);
 
     /*
-     * The number of cycles the instruction takes. This is the sum of the
-     * operation and operand's cycles.
+     * Device state passed back to the callbacks.
      */
-    uint16_t cycles;
+    void     *data;
+};
 
+/*
+ * A callback a device has scheduled to run once the cpu's clock reaches
+ * cycle.
+ */
+struct DeviceEvent
+{
+    uint64_t cycle;
+    void     (*callback)(DCPU16 *dcpu, void *data);
+    void     *data;
+};
 
-    InstructionData();
+/*
+ * Callbacks made by the cpu while stepped with
+ * DCPU16::step<DCPU16::CallbackHooks>(), attached with DCPU16::setHooks().
+ * Any of them may be NULL.
+ */
+struct ExecutionHooks
+{
+    /*
+     * Called when an instruction is fetched for execution, before its
+     * operands are resolved.
+     */
+    void     (*fetch)(DCPU16 *dcpu, uint16_t address, uint16_t instruction, void *data);
+
+    /*
+     * Called for each memory read and after each memory write by the
+     * program, including the pushes and pops of JSR, interrupts and RFI.
+     */
+    void     (*read)(DCPU16 *dcpu, uint16_t address, uint16_t value, void *data);
+    void     (*write)(DCPU16 *dcpu, uint16_t address, uint16_t value, void *data);
+
+    /*
+     * Called when a queued interrupt is triggered, once the cpu has jumped
+     * to the handler.
+     */
+    void     (*interrupt)(DCPU16 *dcpu, uint16_t msg, void *data);
+
+    void     *data;
+
+    /*
+     * The pages write is called for, one bit per page like
+     * DCPU16::dirty_pages, or NULL to call it for every write. Writes to
+     * other pages cost a bit test.
+     */
+    const uint32_t *write_pages;
 };
 
-struct Device
+/*
+ * Per word access counts, collected while attached to a cpu with
+ * DCPU16::setAccessCounters() and stepped with step<CallbackHooks>().
+ * Counts saturate at 0xFFFF.
+ */
+struct AccessCounters
 {
-    uint32_t (*getHardwareID)();
-    uint16_t (*getHardwareVersion)();
-    uint32_t (*getManufacturerID)();
-    void     (*interrupt)();
+    uint16_t reads[0x10000];
+    uint16_t writes[0x10000];
+    uint16_t executes[0x10000];
+};
+
+/*
+ * AFL style edge coverage, collected while attached to a cpu with
+ * DCPU16::setCoverage() and stepped with
+ * DCPU16::step<DCPU16::CoverageHooks>(). Every instruction fetch counts
+ * the edge from the previous fetch address in map, at a hash of both
+ * addresses. Counts saturate at 0xFF.
+ */
+struct EdgeCoverage
+{
+    enum
+    {
+        MAP_SIZE = 0x10000,
+    };
+
+    uint8_t  map[MAP_SIZE];
+
+    /*
+     * The entries of map hit so far, in the order they were first hit, so
+     * that reading and clearing the map doesn't have to go through all of
+     * it. Whoever clears map entries removes them here as well.
+     */
+    uint16_t hits[MAP_SIZE];
+    uint32_t num_hits;
+
+    /* Hash of the previous fetch address, shifted so edges have a direction. */
+    uint16_t previous;
 };
 
+/*
+ * Runtime counters of a cpu, attached with DCPU16::setStats() and updated
+ * while it is stepped with step<CallbackHooks>(). Only the thread running
+ * the cpu writes them and other threads may read them at any time with
+ * RuntimeStats::load(). The block is aligned to a cache line so readers
+ * polling it don't share a line with unrelated data.
+ */
+struct RuntimeStats
+{
+    enum
+    {
+        /* HWI calls to devices past this are only counted in hwi_other. */
+        MAX_DEVICES = 16,
+
+        /* Must match DCPU16::NUM_ERRORS, checked in dcpu16.cpp. */
+        MAX_ERRORS  = 6,
+    };
+
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t interrupts;
+    uint64_t hwi_calls[MAX_DEVICES];
+    uint64_t hwi_other;
+    uint64_t errors[MAX_ERRORS];
+
+    /* Bytes of cpu states kept by a Debugger for stepping backwards. */
+    uint64_t history_bytes;
+
+
+    RuntimeStats();
+
+    /*
+     * Counters are updated with relaxed atomic loads and stores rather than
+     * read-modify-write instructions, which is safe with a single writer and
+     * costs the same as a plain increment.
+     */
+    static void     add(uint64_t *counter, uint64_t n)
+    {
+        __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+    }
+
+    static void     store(uint64_t *counter, uint64_t value)
+    {
+        __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+    }
+
+    static uint64_t load(const uint64_t *counter)
+    {
+        return __atomic_load_n(counter, __ATOMIC_RELAXED);
+    }
+} __attribute__((aligned(64)));
+
 
 class DCPU16
 {
@@ -123,11 +280,44 @@ public:
         INST_OP_SHIFT = 0,
         INST_OP_MASK  = 0x1F,
 
-        INST_VA_SHIFT = 5,
-        INST_VA_MASK  = 0x3E0,
+        INST_VA_SHIFT = 10,
+        INST_VA_MASK  = 0xFC00,
+
+        INST_VB_SHIFT = 5,
+        INST_VB_MASK  = 0x3E0,
+    };
+
+    /*
+     * OperationInfo flags.
+     */
+    enum
+    {
+        OPERATION_VALID       = 0x01,
+        OPERATION_CONDITIONAL = 0x02,
+
+        /* Writes to b for basic operations, to a for special operations. */
+        OPERATION_WRITES      = 0x04,
+    };
 
-        INST_VB_SHIFT = 10,
-        INST_VB_MASK  = 0xFC00,
+    /*
+     * OperandInfo modes.
+     */
+    enum
+    {
+        MODE_REGISTER,
+        MODE_REGISTER_PTR,
+        MODE_REGISTER_NEXT_WORD_PTR,
+        MODE_PUSH_POP,
+        MODE_PEEK,
+        MODE_PICK,
+        MODE_SP,
+        MODE_PC,
+        MODE_EX,
+        MODE_NEXT_WORD_PTR,
+        MODE_NEXT_WORD_LITERAL,
+        MODE_LITERAL,
+
+        NUM_MODES,
     };
 
     enum
@@ -141,6 +331,11 @@ public:
         ERROR_STACK_UNDERFLOW,
         ERROR_OPCODE_INVALID,
         ERROR_INTERRUPT_QUEUE_FULL,
+
+        /* Replayed input doesn't match what the program does. */
+        ERROR_REPLAY_MISMATCH,
+
+        NUM_ERRORS,
     };
 
     enum
@@ -148,6 +343,16 @@ public:
         MEMORY_SIZE = 0x10000,
     };
 
+    /*
+     * Memory is split into pages for write tracking.
+     */
+    enum
+    {
+        PAGE_SHIFT = 8,
+        PAGE_SIZE = 1 << PAGE_SHIFT,
+        NUM_PAGES = MEMORY_SIZE >> PAGE_SHIFT,
+    };
+
     enum
     {
         REG_A = 0x00,
@@ -225,6 +430,22 @@ public:
         MAX_INTERRUPTS = 256,
     };
 
+    enum
+    {
+        NUM_OPERATIONS   = 32,
+        NUM_OPERANDS     = 64,
+        NUM_INSTRUCTIONS = 0x10000,
+    };
+
+    /*
+     * Instruction set tables indexed by opcode and operand value. These are
+     * the single source of names, cycle costs and operand behaviour for the
+     * emulator, the disassembler and the assembler.
+     */
+    static const OperationInfo basic_operations[NUM_OPERATIONS];
+    static const OperationInfo special_operations[NUM_OPERATIONS];
+    static const OperandInfo   operands[NUM_OPERANDS];
+
     enum
     {
         MAX_DEVICES = 0xFFFF,
@@ -248,17 +469,91 @@ public:
     uint16_t mem[MEMORY_SIZE];
     uint8_t  mem_flags[MEMORY_SIZE];
 
+    /*
+     * One bit per page, set when a word in the page is written. Whoever
+     * reacts to memory changes clears them once it has caught up.
+     */
+    uint32_t dirty_pages[NUM_PAGES / 32];
+
+    /*
+     * Pages written since memory last matched fork_parent's, or was all
+     * zeros after a reset if fork_parent is NULL. fork() from the same
+     * parent and reset() only need to restore these pages.
+     */
+    uint32_t written_pages[NUM_PAGES / 32];
+    const DCPU16 *fork_parent;
+
+    /*
+     * Counters for every memory access, or NULL when not counting. Reads
+     * are operands whose value is read from memory, so the b of SET, STI
+     * and STD only counts as a write. Executes are instruction fetches.
+     */
+    AccessCounters *access_counters;
+
+    /*
+     * Edge coverage for CoverageHooks, or NULL.
+     */
+    EdgeCoverage *coverage;
+
+    /*
+     * Runtime counters, or NULL when not collecting them.
+     */
+    RuntimeStats *stats;
+
+    /*
+     * Callbacks for CallbackHooks, or NULL.
+     */
+    const ExecutionHooks *hooks;
+
     uint64_t clock;
     int      error;
 
+    /*
+     * Whether setError prints the error to stdout. On by default.
+     */
+    bool     print_errors;
+
     InstructionData last_instruction;
 
+    /*
+     * Interrupts are kept in a circular FIFO. interrupt_pending is true when
+     * the queue is not empty and queueing is disabled, i.e. the next step()
+     * must trigger an interrupt.
+     */
     bool     interrupt_queueing;
+    bool     interrupt_pending;
     uint16_t interrupt_queue[MAX_INTERRUPTS];
-    uint16_t interrupt_count;;
+    uint16_t interrupt_head;
+    uint16_t interrupt_count;
 
     std::vector<Device> devices;
-    
+
+    /*
+     * Pending device events kept as a min heap on cycle. next_event caches the
+     * cycle of the earliest event so step() only does a single compare.
+     */
+    std::vector<DeviceEvent> events;
+    uint64_t next_event;
+
+    /*
+     * Input log being recorded or replayed, or NULL. input_position is the
+     * offset of the next entry and is part of the cpu state, so copies of
+     * the cpu each have their own place in the log. next_input caches the
+     * clock of the next entry to replay between instructions. input_nested
+     * is set while a device handles HWI.
+     */
+    InputLog *input_log;
+    size_t   input_position;
+    uint64_t next_input;
+    bool     input_nested;
+
+    /*
+     * Clock value at which step() has to service events, interrupts or
+     * replayed input before executing an instruction. This is 0 while an
+     * interrupt is pending so all are covered by a single compare.
+     */
+    uint64_t next_service;
+
 
 /*---------------------------------------------------------------------------
  * Initialization
@@ -271,25 +566,92 @@ public:
  * Instruction Processing
  *--------------------------------------------------------------------------*/
 public:
-    InstructionData     nextInstruction();
     void                splitInstruction(uint16_t instruction, uint16_t *op, uint16_t *oa, uint16_t *ob) const;
 
     int                 getInstructionCycles(uint16_t instruction) const;
     int                 getOperationCycles(uint16_t instruction) const;
     int                 getOperandCycles(uint16_t operand) const;
 
+    static const OperationInfo& getOperationInfo(uint16_t instruction);
+    static const OperandInfo&   getOperandInfo(uint16_t operand);
+    static int          getInstructionLength(uint16_t instruction);
+
+    /*
+     * Hook policies for step<HOOKS>(). Hooks are static functions of the
+     * policy called from the instruction handlers, so NoHooks compiles to
+     * the same code as having no hooks at all, CallbackHooks counts into
+     * the attached AccessCounters and RuntimeStats and calls the
+     * ExecutionHooks attached with setHooks(), and CoverageHooks counts
+     * edges in the EdgeCoverage attached with setCoverage().
+     */
+    struct NoHooks;
+    struct CallbackHooks;
+    struct CoverageHooks;
+
 private:
-    void                processOperand(uint16_t operand, uint16_t **ptr, uint16_t *value, char source);
-    void                doOpcode(uint16_t op, uint16_t a, uint16_t b, uint16_t *bptr, bool *skip_next);
-    void                doOpcodeExt0(uint16_t op, uint16_t a, uint16_t b, uint16_t *aptr);
-    uint16_t            arithmeticShift(uint16_t i, uint16_t s);
+    /*
+     * Operand accessors, one per MODE_* constant. Each resolves its operand
+     * to a memory address (or nothing) and reads and writes through it, so
+     * register operands are accessed by index rather than through pointers
+     * that may alias memory.
+     */
+    template<int MODE, int SOURCE, class HOOKS> struct Operand;
+    template<class HOOKS> struct MemoryOperand;
+
+    /*
+     * Instruction handlers specialized on the operation and the modes of
+     * both operands. handlers is indexed by instruction word and filled
+     * from the specialized tables at startup, so decoding an instruction is
+     * a single table load. Each handler adds its own cycles, which are a
+     * constant for its operation and modes. Register numbers and literal
+     * values are still
+     * read from the operand table, which keeps the number of handlers to
+     * one per operation and mode pair rather than one per instruction word.
+     * Each hook policy has its own set of tables.
+     *
+     * @return true if the instruction is a conditional that failed.
+     */
+    typedef bool (*Handler)(DCPU16 *cpu, uint16_t instruction);
+
+    template<class HOOKS>
+    struct Handlers
+    {
+        static Handler       table[NUM_INSTRUCTIONS];
+        static const Handler basic[NUM_OPERATIONS][NUM_MODES][NUM_MODES];
+        static const Handler special[NUM_OPERATIONS][NUM_MODES];
+        static const bool    built;
+
+        static bool          build();
+    };
+
+    template<class HOOKS, int OP, int A_MODE, int B_MODE>
+    static bool         executeBasic(DCPU16 *cpu, uint16_t instruction);
+    template<class HOOKS, int OP, int A_MODE>
+    static bool         executeSpecial(DCPU16 *cpu, uint16_t instruction);
+
+    void                skipInstruction();
+    template<class HOOKS, int OP, int B_MODE>
+    bool                doOpcode(uint16_t a, uint16_t b, const OperandInfo &b_info, uint16_t b_address);
+    template<class HOOKS, int OP, int A_MODE>
+    void                doOpcodeExt0(uint16_t a, const OperandInfo &a_info, uint16_t a_address);
 
 
 /*---------------------------------------------------------------------------
  * Interrupts 
  *--------------------------------------------------------------------------*/
+public:
+    void                interrupt(uint16_t msg);
+
+private:
+    template<class HOOKS>
     void                beginInterrupt(uint16_t msg);
+    template<class HOOKS>
     void                endInterrupt();
+    void                queueInterrupt(uint16_t msg);
+    void                setInterruptQueueing(bool queueing);
+    void                updatePending();
+    template<class HOOKS>
+    void                service();
 
 
 /*---------------------------------------------------------------------------
@@ -298,8 +660,17 @@ private:
 public:
     void                loadProgram(const uint16_t *words, uint16_t num_words);
     void                step();
+    template<class HOOKS>
+    void                step();
     void                reset();
+    void                fork(const DCPU16 &parent);
     uint64_t            getCycles() const;
+    void                setStats(RuntimeStats *stats);
+    void                setHooks(const ExecutionHooks *hooks);
+    void                setCoverage(EdgeCoverage *coverage);
+
+private:
+    void                restoreWrittenPages(const DCPU16 *parent);
 
 
 /*---------------------------------------------------------------------------
@@ -310,8 +681,18 @@ public:
     void                write(uint32_t addr, uint16_t value);
     const uint16_t*     memoryPointer() const;
 
+    void                markDirty(uint16_t addr, uint32_t count);
+    void                deviceWrite(uint16_t addr, const uint16_t *words, uint32_t count);
+    bool                isPageDirty(int page) const;
+    void                clearDirtyPages();
+    void                setAccessCounters(AccessCounters *counters);
+
 private:
-    bool                writePtr(uint16_t *ptr, uint16_t value);
+    template<class HOOKS>
+    uint16_t            readMemory(uint16_t addr);
+    template<class HOOKS>
+    void                writeMemory(uint16_t addr, uint16_t value);
+    void                noteWrite(uint16_t addr);
 
 
 /*---------------------------------------------------------------------------
@@ -321,12 +702,34 @@ public:
     bool                attachDevice(Device device, uint16_t *devices);
     void                detachAllDevices();
 
+    void                scheduleEvent(uint64_t cycles, void (*callback)(DCPU16*, void*), void *data);
+    void                cancelEvents(void *data);
+
+private:
+    void                processEvents();
+    void                hardwareInterrupt(uint16_t device);
+
+
+/*---------------------------------------------------------------------------
+ * Input Recording
+ *--------------------------------------------------------------------------*/
+public:
+    void                setInputLog(InputLog *log);
+
+private:
+    void                recordInput(InputLog::Entry *entry);
+    void                replayInput();
+    void                replayHardwareInterrupt(uint16_t device);
+    void                applyInput(const InputLog::Entry &entry);
+    void                updateNextInput();
+
 /*---------------------------------------------------------------------------
  * Error State
  *--------------------------------------------------------------------------*/
 public:
     int                 getError() const;
-    const char*         getErrorString(int err) const;
+    static const char*  getErrorString(int err);
+    void                setErrorPrinting(bool print);
 
 private:
     void                setError(int err);
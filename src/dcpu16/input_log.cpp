@@ -0,0 +1,217 @@
+#include <cstdio>
+#include <cstring>
+
+#include "input_log.h"
+
+/*
+ * Log files start with this, followed by the entries.
+ */
+static const char FILE_MAGIC[4] = {'D', 'I', 'L', '1'};
+
+
+InputLog::InputLog(int mode)
+{
+    this->mode = mode;
+}
+
+int InputLog::getMode() const
+{
+    return mode;
+}
+
+/*
+ * @return The size of the entries in bytes. Positions passed to read() are
+ *         offsets below this.
+ */
+size_t InputLog::size() const
+{
+    return data.size();
+}
+
+/*
+ * Drops the entries from size on.
+ */
+void InputLog::truncate(size_t size)
+{
+    if(size < data.size())
+        data.resize(size);
+}
+
+void InputLog::append(const Entry &entry)
+{
+    appendNumber(entry.clock);
+    data.push_back(entry.type);
+
+    switch(entry.type & ENTRY_TYPE_MASK)
+    {
+    case ENTRY_INTERRUPT:
+        appendNumber(entry.value);
+        break;
+
+    case ENTRY_MEMORY:
+        appendNumber(entry.value);
+        appendNumber(entry.count);
+        data.insert(data.end(), entry.words, entry.words + entry.count * 2);
+        break;
+
+    case ENTRY_HWI:
+        appendNumber(entry.value);
+        appendNumber(entry.count);
+        data.push_back(entry.reg_mask);
+
+        for(int i = 0; i < 8; i++)
+            if(entry.reg_mask & (1 << i))
+                appendNumber(entry.reg[i]);
+        break;
+    }
+}
+
+/*
+ * Reads the entry at position and moves position past it. words points into
+ * the log and stays valid until the log is changed.
+ *
+ * @return false at the end of the log or if the entry is cut short.
+ */
+bool InputLog::read(size_t *position, Entry *entry) const
+{
+    size_t pos = *position;
+    uint64_t n;
+
+    if(!readNumber(&pos, &entry->clock) || pos >= data.size())
+        return false;
+
+    entry->type = data[pos++];
+    entry->count = 0;
+    entry->words = NULL;
+    entry->reg_mask = 0;
+
+    switch(entry->type & ENTRY_TYPE_MASK)
+    {
+    case ENTRY_INTERRUPT:
+        if(!readNumber(&pos, &n))
+            return false;
+        entry->value = uint16_t(n);
+        break;
+
+    case ENTRY_MEMORY:
+        if(!readNumber(&pos, &n))
+            return false;
+        entry->value = uint16_t(n);
+
+        if(!readNumber(&pos, &n) || n > 0x10000 || data.size() - pos < n * 2)
+            return false;
+        entry->count = uint32_t(n);
+        entry->words = &data[0] + pos;
+        pos += n * 2;
+        break;
+
+    case ENTRY_HWI:
+        if(!readNumber(&pos, &n))
+            return false;
+        entry->value = uint16_t(n);
+
+        if(!readNumber(&pos, &n) || pos >= data.size())
+            return false;
+        entry->count = uint32_t(n);
+        entry->reg_mask = data[pos++];
+
+        for(int i = 0; i < 8; i++)
+        {
+            if(!(entry->reg_mask & (1 << i)))
+                continue;
+            if(!readNumber(&pos, &n))
+                return false;
+            entry->reg[i] = uint16_t(n);
+        }
+        break;
+
+    default:
+        return false;
+    }
+
+    *position = pos;
+    return true;
+}
+
+void InputLog::appendNumber(uint64_t n)
+{
+    while(n >= 0x80)
+    {
+        data.push_back(uint8_t(n | 0x80));
+        n >>= 7;
+    }
+
+    data.push_back(uint8_t(n));
+}
+
+bool InputLog::readNumber(size_t *position, uint64_t *n) const
+{
+    size_t pos = *position;
+    *n = 0;
+
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        if(pos >= data.size())
+            return false;
+
+        uint8_t byte = data[pos++];
+        *n |= uint64_t(byte & 0x7F) << shift;
+
+        if(!(byte & 0x80))
+        {
+            *position = pos;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * @return false if the file couldn't be written.
+ */
+bool InputLog::save(const char *path) const
+{
+    FILE *file = fopen(path, "wb");
+    if(!file)
+        return false;
+
+    bool ok = fwrite(FILE_MAGIC, 1, sizeof(FILE_MAGIC), file) == sizeof(FILE_MAGIC);
+    if(ok && !data.empty())
+        ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+
+    return ok;
+}
+
+/*
+ * Replaces the entries with those in the file. Entries are only checked as
+ * they are read.
+ *
+ * @return false if the file couldn't be read or isn't an input log.
+ */
+bool InputLog::load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        return false;
+
+    char magic[sizeof(FILE_MAGIC)];
+    bool ok = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+              memcmp(magic, FILE_MAGIC, sizeof(magic)) == 0;
+
+    std::vector<uint8_t> entries;
+    uint8_t buffer[4096];
+    size_t n;
+
+    while(ok && (n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        entries.insert(entries.end(), buffer, buffer + n);
+
+    ok = ok && !ferror(file);
+    fclose(file);
+
+    if(ok)
+        data.swap(entries);
+
+    return ok;
+}
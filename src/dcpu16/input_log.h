@@ -0,0 +1,110 @@
+/*
+ * Log of the input a cpu receives from outside the program, for recording a
+ * run and replaying it exactly.
+ *
+ * Entries are stored back to back in a compact binary form: the clock value
+ * at which the input was delivered and the entry type, followed by the
+ * entry's fields. Numbers are stored as variable length integers, 7 bits per
+ * byte with the high bit set on all but the last byte, and memory words as
+ * two little endian bytes.
+ */
+
+#ifndef INPUT_LOG_H
+#define INPUT_LOG_H
+
+#include <cstddef>
+#include <vector>
+#include "../library/pstdint.h"
+
+class InputLog
+{
+/*---------------------------------------------------------------------------
+ * Types
+ *--------------------------------------------------------------------------*/
+public:
+    enum
+    {
+        MODE_RECORD,
+        MODE_REPLAY,
+    };
+
+    enum
+    {
+        /* An interrupt raised by a device or the host. */
+        ENTRY_INTERRUPT = 0x01,
+
+        /* Words a device copied into memory. */
+        ENTRY_MEMORY    = 0x02,
+
+        /* The registers and extra cycles an HWI left behind. */
+        ENTRY_HWI       = 0x03,
+
+        ENTRY_TYPE_MASK = 0x7F,
+
+        /*
+         * Set on input delivered while a device handled HWI. Such entries
+         * come before the HWI entry and are replayed with it.
+         */
+        ENTRY_NESTED    = 0x80,
+    };
+
+    struct Entry
+    {
+        uint64_t clock;
+        uint8_t  type;
+
+        /* Interrupt message, memory address or device index. */
+        uint16_t value;
+
+        /* Number of memory words or extra HWI cycles. */
+        uint32_t count;
+
+        /* Memory words, little endian. */
+        const uint8_t *words;
+
+        /* HWI registers, reg[i] is valid if bit i of reg_mask is set. */
+        uint8_t  reg_mask;
+        uint16_t reg[8];
+    };
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    int mode;
+    std::vector<uint8_t> data;
+
+
+/*---------------------------------------------------------------------------
+ * Construct/Destruct
+ *--------------------------------------------------------------------------*/
+public:
+                        InputLog(int mode);
+
+    int                 getMode() const;
+    size_t              size() const;
+    void                truncate(size_t size);
+
+
+/*---------------------------------------------------------------------------
+ * Entries
+ *--------------------------------------------------------------------------*/
+public:
+    void                append(const Entry &entry);
+    bool                read(size_t *position, Entry *entry) const;
+
+private:
+    void                appendNumber(uint64_t n);
+    bool                readNumber(size_t *position, uint64_t *n) const;
+
+
+/*---------------------------------------------------------------------------
+ * Files
+ *--------------------------------------------------------------------------*/
+public:
+    bool                save(const char *path) const;
+    bool                load(const char *path);
+};
+
+#endif /* INPUT_LOG_H */
@@ -1,7 +1,11 @@
 #include <iostream>
 #include "dcpu16.h"
+#include "../metrics/metrics_exporter.h"
 
-int main()
+/*
+ * Usage: dcpu [metrics-file]
+ */
+int main(int argc, char **argv)
 {
     std::cout << sizeof(DCPU16) << std::endl;
 
@@ -12,15 +16,23 @@ int main()
         0x9037, 0x61c1, 0x7dc1, 0x001a, 0x0000, 0x0000, 0x0000, 0x0000
     };
 
+    static RuntimeStats stats;
+    MetricsExporter metrics;
+
     DCPU16 dcpu;
+    dcpu.setStats(&stats);
     dcpu.loadProgram(prog, 32);
+    metrics.addInstance("dcpu", &stats);
 
     //while(!dcpu.getError())
     for(int i = 0; i < 64; i++)
     {
         dcpu.printState();
-        dcpu.step();
+        dcpu.step<DCPU16::CallbackHooks>();
     }
     dcpu.printState();
+
+    if(argc > 1 && !metrics.writeFile(argv[1]))
+        std::cerr << "Could not write metrics to " << argv[1] << std::endl;
 }
 
@@ -1,10 +1,23 @@
+#include <algorithm>
 #include "debugger.h"
 
+/*
+ * Copies words into memory, wrapping around its end.
+ */
+static void writeWords(uint16_t *mem, uint16_t address, const uint16_t *words, uint32_t count)
+{
+    uint32_t first = std::min<uint32_t>(count, DCPU16::MEMORY_SIZE - address);
+
+    std::copy(words, words + first, mem + address);
+    std::copy(words + first, words + count, mem);
+}
+
 
 void Debugger::loadProgram(uint16_t *words, uint16_t num_words)
 {
     initial_state = DCPU16();
     initial_state.loadProgram(words, num_words);
+    disassembly.disassemble(initial_state.mem, DCPU16::MEMORY_SIZE);
     reset();
 }
 
@@ -21,7 +34,7 @@ void Debugger::step(int steps)
         for(int i = 0; i < steps && !dcpu.getError(); i++)
         {
             pushHistory();
-            dcpu.step();
+            dcpu.step<DCPU16::CallbackHooks>();
         }
     }
     else if(steps < 0)
@@ -32,8 +45,9 @@ void Debugger::step(int steps)
 
 void Debugger::reset()
 {
-    dcpu = initial_state;
+    restore(initial_state);
     history.clear();
+    updateHistoryStats();
 }
 
 void Debugger::setRegister(uint16_t register, uint16_t value)
@@ -41,6 +55,40 @@ void Debugger::setRegister(uint16_t register, uint16_t value)
 
 }
 
+/*
+ * Hot patches words into the running program. The program that reset()
+ * restores and the history are patched too, so neither a reset nor stepping
+ * backwards undoes the patch. The disassembly of the loaded program is
+ * updated.
+ */
+void Debugger::patch(uint16_t address, const uint16_t *words, uint32_t count)
+{
+    count = std::min<uint32_t>(count, DCPU16::MEMORY_SIZE);
+
+    writeWords(dcpu.mem, address, words, count);
+    dcpu.markDirty(address, count);
+    writeWords(initial_state.mem, address, words, count);
+    initial_state.markDirty(address, count);
+
+    for(std::deque<DCPU16>::iterator it = history.begin(); it != history.end(); ++it)
+    {
+        writeWords(it->mem, address, words, count);
+        it->markDirty(address, count);
+    }
+
+    if(count == DCPU16::MEMORY_SIZE)
+    {
+        disassembly.disassemble(initial_state.mem, DCPU16::MEMORY_SIZE);
+        return;
+    }
+
+    uint32_t first = std::min<uint32_t>(count, DCPU16::MEMORY_SIZE - address);
+    disassembly.update(initial_state.mem, DCPU16::MEMORY_SIZE, address, uint16_t(first));
+
+    if(first < count)
+        disassembly.update(initial_state.mem, DCPU16::MEMORY_SIZE, 0, uint16_t(count - first));
+}
+
 DCPU16& Debugger::getDCPU()
 {
     return dcpu;
@@ -51,6 +99,11 @@ const DCPU16& Debugger::getDCPU() const
     return dcpu;
 }
 
+const Disassembler& Debugger::getDisassembly() const
+{
+    return disassembly;
+}
+
 void Debugger::pushHistory()
 {
     //TODO serialize and compress
@@ -59,6 +112,8 @@ void Debugger::pushHistory()
     //TODO max history size
     if(history.size() > 100)
         history.pop_front();
+
+    updateHistoryStats();
 }
 
 void Debugger::popHistory(int n)
@@ -66,7 +121,35 @@ void Debugger::popHistory(int n)
     if(history.empty())
         return;
 
-    dcpu = history.back();
+    restore(history.back());
     history.pop_back();
+    updateHistoryStats();
+}
+
+/*
+ * Replaces the cpu state. Access counters, stats, hooks and the input log
+ * stay attached and all of memory is marked as written. The input log moves
+ * to where the state was in it, so with a replayed log, seeking gives the
+ * same results as running to the state.
+ */
+void Debugger::restore(const DCPU16 &state)
+{
+    AccessCounters *counters = dcpu.access_counters;
+    RuntimeStats *stats = dcpu.stats;
+    const ExecutionHooks *hooks = dcpu.hooks;
+    InputLog *input_log = dcpu.input_log;
+
+    dcpu = state;
+    dcpu.setAccessCounters(counters);
+    dcpu.setStats(stats);
+    dcpu.setHooks(hooks);
+    dcpu.setInputLog(input_log);
+    dcpu.markDirty(0, DCPU16::MEMORY_SIZE);
+}
+
+void Debugger::updateHistoryStats()
+{
+    if(dcpu.stats)
+        RuntimeStats::store(&dcpu.stats->history_bytes, history.size() * sizeof(DCPU16));
 }
 
@@ -4,6 +4,7 @@
 #include <vector>
 #include <deque>
 #include "../dcpu16/dcpu16.h"
+#include "../disassembler/disassembler.h"
 
 class Debugger
 {
@@ -11,6 +12,7 @@ private:
     DCPU16 dcpu;
     DCPU16 initial_state;
     std::deque<DCPU16> history;
+    Disassembler disassembly;
 
 public:
     void loadProgram(uint16_t *words, uint16_t num_words);
@@ -19,12 +21,18 @@ public:
     void reset();
 
     void setRegister(uint16_t register, uint16_t value);
+    void patch(uint16_t address, const uint16_t *words, uint32_t count);
 
     DCPU16& getDCPU();
     const DCPU16& getDCPU() const;
+    const Disassembler& getDisassembly() const;
 
     void pushHistory();
     void popHistory(int n);
+
+private:
+    void restore(const DCPU16 &state);
+    void updateHistoryStats();
 };
 
 #endif /* DEBUGGER_H */
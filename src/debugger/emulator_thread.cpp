@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <cstring>
+#include "emulator_thread.h"
+#include "../assembler/assemble.h"
+
+
+EmulatorThread::EmulatorThread()
+{
+    started = false;
+    sem_init(&wake, 0, 0);
+
+    command_head = 0;
+    command_tail = 0;
+
+    snapshots[0].running = false;
+    snapshots[1].running = false;
+    snapshot_counters[0] = NULL;
+    snapshot_counters[1] = NULL;
+    front = 0;
+    ready = 0;
+    current = 0;
+
+    std::fill(breakpoints, breakpoints + DCPU16::MEMORY_SIZE/32, 0);
+    debugger.getDCPU().setHooks(watches.getHooks());
+    counters = NULL;
+    running = false;
+    changed = true;
+    quit = false;
+}
+
+EmulatorThread::~EmulatorThread()
+{
+    if(started)
+    {
+        while(!send(CMD_QUIT, 0, 0, 0))
+            sched_yield();
+
+        pthread_join(thread, NULL);
+
+        Command cmd;
+        while(receive(&cmd))
+            delete[] cmd.words;
+    }
+
+    sem_destroy(&wake);
+
+    delete counters;
+    delete snapshot_counters[0];
+    delete snapshot_counters[1];
+}
+
+/*
+ * The debugger may only be used directly before start().
+ */
+Debugger& EmulatorThread::getDebugger()
+{
+    return debugger;
+}
+
+/*
+ * Sets the function writes to watched ranges are reported to. Like
+ * getDebugger(), only before start().
+ */
+void EmulatorThread::setWatchCallback(WatchList::Callback callback, void *data)
+{
+    watches.setCallback(callback, data);
+}
+
+bool EmulatorThread::start()
+{
+    if(started)
+        return true;
+
+    started = pthread_create(&thread, NULL, threadMain, this) == 0;
+    return started;
+}
+
+bool EmulatorThread::run()                              { return send(CMD_RUN, 0, 0, 0); }
+bool EmulatorThread::pause()                            { return send(CMD_PAUSE, 0, 0, 0); }
+bool EmulatorThread::step(int steps)                    { return send(CMD_STEP, 0, 0, steps); }
+bool EmulatorThread::reset()                            { return send(CMD_RESET, 0, 0, 0); }
+bool EmulatorThread::write(uint32_t rw_id, uint16_t value) { return send(CMD_WRITE, rw_id, value, 0); }
+/*
+ * Queues a hot patch of the program, see Debugger::patch(). The words are
+ * copied, so the caller can reuse them right away.
+ */
+bool EmulatorThread::patch(uint16_t address, const uint16_t *words, uint32_t count)
+{
+    count = std::min<uint32_t>(count, DCPU16::MEMORY_SIZE);
+
+    uint16_t *copy = new uint16_t[count];
+    std::copy(words, words + count, copy);
+
+    if(send(CMD_PATCH, address, 0, int(count), copy))
+        return true;
+
+    delete[] copy;
+    return false;
+}
+
+/*
+ * Queues the words that changed in the assembler's last reassembly. Either
+ * all of its patches are queued or none are.
+ *
+ * @return false if the queue doesn't have room for all of them.
+ */
+bool EmulatorThread::patch(const Assembler &assembler)
+{
+    const std::vector<Assembler::Patch> &patches = assembler.getPatches();
+    const std::vector<uint16_t> &words = assembler.getWords();
+
+    /* only the worker frees room, so it can't shrink after this check. */
+    uint32_t head = __atomic_load_n(&command_head, __ATOMIC_ACQUIRE);
+    if(command_tail - head + patches.size() > MAX_COMMANDS)
+        return false;
+
+    for(size_t i = 0; i < patches.size(); i++)
+        patch(patches[i].address, &words[patches[i].address], patches[i].count);
+
+    return true;
+}
+
+bool EmulatorThread::addBreakpoint(uint16_t address)    { return send(CMD_ADD_BREAKPOINT, address, 0, 0); }
+bool EmulatorThread::removeBreakpoint(uint16_t address) { return send(CMD_REMOVE_BREAKPOINT, address, 0, 0); }
+bool EmulatorThread::addWatch(uint16_t first, uint16_t last)    { return send(CMD_ADD_WATCH, first, last, 0); }
+bool EmulatorThread::removeWatch(uint16_t first, uint16_t last) { return send(CMD_REMOVE_WATCH, first, last, 0); }
+bool EmulatorThread::countAccesses(bool enable)         { return send(CMD_COUNT_ACCESSES, 0, enable, 0); }
+
+/*
+ * Queues a command for the worker.
+ *
+ * @return false if the queue is full.
+ */
+bool EmulatorThread::send(int type, uint32_t address, uint16_t value, int count, uint16_t *words)
+{
+    uint32_t tail = command_tail;
+    uint32_t head = __atomic_load_n(&command_head, __ATOMIC_ACQUIRE);
+
+    if(tail - head >= MAX_COMMANDS)
+        return false;
+
+    Command &cmd = commands[tail % MAX_COMMANDS];
+    cmd.type = type;
+    cmd.address = address;
+    cmd.value = value;
+    cmd.count = count;
+    cmd.words = words;
+
+    __atomic_store_n(&command_tail, tail + 1, __ATOMIC_RELEASE);
+    sem_post(&wake);
+    return true;
+}
+
+bool EmulatorThread::receive(Command *cmd)
+{
+    uint32_t head = command_head;
+    uint32_t tail = __atomic_load_n(&command_tail, __ATOMIC_ACQUIRE);
+
+    if(head == tail)
+        return false;
+
+    *cmd = commands[head % MAX_COMMANDS];
+
+    __atomic_store_n(&command_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * Picks up the latest snapshot if a new one was published. Called from the
+ * controlling thread, which must not hold on to the previous snapshot
+ * afterwards.
+ *
+ * @return true if getSnapshot() changed.
+ */
+bool EmulatorThread::pollSnapshot()
+{
+    if(!__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+        return false;
+
+    current = __atomic_load_n(&front, __ATOMIC_RELAXED);
+    __atomic_store_n(&ready, 0, __ATOMIC_RELEASE);
+
+    /* the worker may be paused with changes it couldn't publish yet. */
+    sem_post(&wake);
+    return true;
+}
+
+const EmulatorThread::Snapshot& EmulatorThread::getSnapshot() const
+{
+    return snapshots[current];
+}
+
+/*
+ * Fills the buffer that isn't being read and makes it the front buffer. It
+ * was last filled two snapshots ago, so pages written since then are the
+ * pages written for the front snapshot plus those written since.
+ */
+void EmulatorThread::publish()
+{
+    Snapshot &back = snapshots[1 - front];
+    const DCPU16 &previous = snapshots[front].dcpu;
+    DCPU16 &dcpu = debugger.getDCPU();
+
+    for(int page = 0; page < DCPU16::NUM_PAGES; page++)
+    {
+        if(dcpu.isPageDirty(page) || previous.isPageDirty(page))
+        {
+            size_t offset = size_t(page) << DCPU16::PAGE_SHIFT;
+            memcpy(back.dcpu.mem + offset, dcpu.mem + offset, DCPU16::PAGE_SIZE * sizeof(uint16_t));
+        }
+    }
+
+    memcpy(back.dcpu.dirty_pages, dcpu.dirty_pages, sizeof(dcpu.dirty_pages));
+    dcpu.clearDirtyPages();
+
+    back.dcpu.pc = dcpu.pc;
+    back.dcpu.sp = dcpu.sp;
+    back.dcpu.ex = dcpu.ex;
+    back.dcpu.ia = dcpu.ia;
+    std::copy(dcpu.reg, dcpu.reg + DCPU16::NUM_REGISTERS, back.dcpu.reg);
+    back.dcpu.clock = dcpu.clock;
+    back.dcpu.error = dcpu.error;
+    back.dcpu.last_instruction = dcpu.last_instruction;
+    back.dcpu.interrupt_queueing = dcpu.interrupt_queueing;
+    back.dcpu.interrupt_pending = dcpu.interrupt_pending;
+    back.dcpu.interrupt_head = dcpu.interrupt_head;
+    back.dcpu.interrupt_count = dcpu.interrupt_count;
+    std::copy(dcpu.interrupt_queue, dcpu.interrupt_queue + DCPU16::MAX_INTERRUPTS, back.dcpu.interrupt_queue);
+    back.running = running;
+
+    if(dcpu.access_counters)
+    {
+        int index = 1 - front;
+        if(!snapshot_counters[index])
+            snapshot_counters[index] = new AccessCounters();
+
+        copyCounters(dcpu.access_counters->reads, snapshot_counters[index]->reads);
+        copyCounters(dcpu.access_counters->writes, snapshot_counters[index]->writes);
+        copyCounters(dcpu.access_counters->executes, snapshot_counters[index]->executes);
+        back.dcpu.access_counters = snapshot_counters[index];
+    }
+    else
+    {
+        back.dcpu.access_counters = NULL;
+    }
+
+    __atomic_store_n(&front, 1 - front, __ATOMIC_RELAXED);
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+    changed = false;
+}
+
+/*
+ * Copies counters into a snapshot and halves them.
+ */
+void EmulatorThread::copyCounters(uint16_t *counts, uint16_t *copy)
+{
+    for(int i = 0; i < DCPU16::MEMORY_SIZE; i++)
+    {
+        copy[i] = counts[i];
+        counts[i] >>= 1;
+    }
+}
+
+void* EmulatorThread::threadMain(void *data)
+{
+    static_cast<EmulatorThread*>(data)->loop();
+    return NULL;
+}
+
+void EmulatorThread::loop()
+{
+    while(!quit)
+    {
+        Command cmd;
+        while(!quit && receive(&cmd))
+            execute(cmd);
+
+        if(quit)
+            break;
+
+        if(running)
+            runBatch();
+
+        if(changed && !__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+            publish();
+
+        if(!running)
+            sem_wait(&wake);
+    }
+}
+
+void EmulatorThread::execute(const Command &cmd)
+{
+    switch(cmd.type)
+    {
+    case CMD_RUN:
+        /* stepping back after a run returns to where it started. */
+        if(!running)
+            debugger.pushHistory();
+        running = !debugger.getDCPU().getError();
+        break;
+
+    case CMD_PAUSE:
+        running = false;
+        break;
+
+    case CMD_STEP:
+        running = false;
+        debugger.step(cmd.count);
+        watches.flush();
+        break;
+
+    case CMD_RESET:
+        running = false;
+        debugger.reset();
+        break;
+
+    case CMD_WRITE:
+        debugger.getDCPU().write(cmd.address, cmd.value);
+        break;
+
+    case CMD_PATCH:
+        debugger.patch(uint16_t(cmd.address), cmd.words, uint32_t(cmd.count));
+        delete[] cmd.words;
+        break;
+
+    case CMD_ADD_BREAKPOINT:
+        breakpoints[cmd.address / 32] |= 1u << (cmd.address % 32);
+        break;
+
+    case CMD_REMOVE_BREAKPOINT:
+        breakpoints[cmd.address / 32] &= ~(1u << (cmd.address % 32));
+        break;
+
+    case CMD_ADD_WATCH:
+        watches.add(uint16_t(cmd.address), cmd.value);
+        break;
+
+    case CMD_REMOVE_WATCH:
+        watches.remove(uint16_t(cmd.address), cmd.value);
+        break;
+
+    case CMD_COUNT_ACCESSES:
+        if(cmd.value && !counters)
+            counters = new AccessCounters();
+        debugger.getDCPU().setAccessCounters(cmd.value ? counters : NULL);
+        break;
+
+    case CMD_QUIT:
+        quit = true;
+        break;
+    }
+
+    changed = true;
+}
+
+/*
+ * Runs until a breakpoint, an error or BATCH_SIZE instructions. The
+ * instruction at a breakpoint isn't executed, but resuming from one is.
+ * Writes to watched ranges are reported once the batch ends.
+ */
+void EmulatorThread::runBatch()
+{
+    DCPU16 &dcpu = debugger.getDCPU();
+
+    for(int i = 0; i < BATCH_SIZE; i++)
+    {
+        dcpu.step<DCPU16::CallbackHooks>();
+
+        if(dcpu.getError() || isBreakpoint(dcpu.pc))
+        {
+            running = false;
+            break;
+        }
+    }
+
+    watches.flush();
+    changed = true;
+}
+
+bool EmulatorThread::isBreakpoint(uint16_t address) const
+{
+    return (breakpoints[address / 32] >> (address % 32)) & 1;
+}
@@ -0,0 +1,166 @@
+#ifndef EMULATOR_THREAD_H
+#define EMULATOR_THREAD_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include "debugger.h"
+#include "watch_list.h"
+
+class Assembler;
+
+/*
+ * Runs a Debugger on its own thread.
+ *
+ * The controlling thread sends commands through a lock-free single producer,
+ * single consumer queue and never touches the emulator directly. Instead the
+ * worker publishes snapshots of the cpu state into two buffers. A new
+ * snapshot is only published after the previous one was picked up with
+ * pollSnapshot(), so the buffer being filled is never the one being read.
+ * Memory is copied only for pages written since the buffer was last filled.
+ * The snapshot's dirty pages are the pages written since the previous
+ * snapshot.
+ *
+ * While access counting is on, each snapshot carries the counts since the
+ * previous one plus half of the counts before that, so counters decay once
+ * a word stops being accessed.
+ *
+ * Writes to watched ranges are reported on the worker thread, once per
+ * range after each batch of instructions or step command that wrote it.
+ */
+class EmulatorThread
+{
+/*---------------------------------------------------------------------------
+ * Types
+ *--------------------------------------------------------------------------*/
+public:
+    struct Snapshot
+    {
+        DCPU16 dcpu;
+        bool   running;
+    };
+
+private:
+    enum
+    {
+        CMD_RUN,
+        CMD_PAUSE,
+        CMD_STEP,
+        CMD_RESET,
+        CMD_WRITE,
+        CMD_PATCH,
+        CMD_ADD_BREAKPOINT,
+        CMD_REMOVE_BREAKPOINT,
+        CMD_ADD_WATCH,
+        CMD_REMOVE_WATCH,
+        CMD_COUNT_ACCESSES,
+        CMD_QUIT,
+    };
+
+    enum
+    {
+        MAX_COMMANDS = 256,
+
+        /* Instructions run between checks for commands. */
+        BATCH_SIZE = 10000,
+    };
+
+    struct Command
+    {
+        int      type;
+        uint32_t address;
+        uint16_t value;
+        int      count;
+
+        /* Copy of the words to patch in, owned by the command. */
+        uint16_t *words;
+    };
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    Debugger debugger;
+    pthread_t thread;
+    bool started;
+
+    /* Wakes the worker when it's paused. */
+    sem_t wake;
+
+    Command commands[MAX_COMMANDS];
+    uint32_t command_head;
+    uint32_t command_tail;
+
+    Snapshot snapshots[2];
+    AccessCounters *snapshot_counters[2];
+    int front;
+    int ready;
+    int current;
+
+    /* Worker state. */
+    uint32_t breakpoints[DCPU16::MEMORY_SIZE / 32];
+    WatchList watches;
+    AccessCounters *counters;
+    bool running;
+    bool changed;
+    bool quit;
+
+
+/*---------------------------------------------------------------------------
+ * Construct/Destruct
+ *--------------------------------------------------------------------------*/
+public:
+                        EmulatorThread();
+                        ~EmulatorThread();
+
+    Debugger&           getDebugger();
+    bool                start();
+    void                setWatchCallback(WatchList::Callback callback, void *data);
+
+
+/*---------------------------------------------------------------------------
+ * Commands
+ *--------------------------------------------------------------------------*/
+public:
+    bool                run();
+    bool                pause();
+    bool                step(int steps);
+    bool                reset();
+    bool                write(uint32_t rw_id, uint16_t value);
+    bool                patch(uint16_t address, const uint16_t *words, uint32_t count);
+    bool                patch(const Assembler &assembler);
+    bool                addBreakpoint(uint16_t address);
+    bool                removeBreakpoint(uint16_t address);
+    bool                addWatch(uint16_t first, uint16_t last);
+    bool                removeWatch(uint16_t first, uint16_t last);
+    bool                countAccesses(bool enable);
+
+private:
+    bool                send(int type, uint32_t address, uint16_t value, int count, uint16_t *words = NULL);
+    bool                receive(Command *cmd);
+
+
+/*---------------------------------------------------------------------------
+ * Snapshots
+ *--------------------------------------------------------------------------*/
+public:
+    bool                pollSnapshot();
+    const Snapshot&     getSnapshot() const;
+
+private:
+    void                publish();
+    static void         copyCounters(uint16_t *counts, uint16_t *copy);
+
+
+/*---------------------------------------------------------------------------
+ * Worker
+ *--------------------------------------------------------------------------*/
+private:
+    static void*        threadMain(void *data);
+    void                loop();
+    void                execute(const Command &cmd);
+    void                runBatch();
+    bool                isBreakpoint(uint16_t address) const;
+};
+
+#endif /* EMULATOR_THREAD_H */
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include "watch_list.h"
+
+static WatchList::Hit makeRange(uint16_t first, uint16_t last)
+{
+    WatchList::Hit range;
+    range.first = first;
+    range.last = last;
+    range.low = 0;
+    range.high = 0;
+    range.writes = 0;
+    return range;
+}
+
+static bool rangeLess(const WatchList::Hit &a, const WatchList::Hit &b)
+{
+    return a.first < b.first || (a.first == b.first && a.last < b.last);
+}
+
+
+WatchList::WatchList()
+{
+    std::fill(pages, pages + DCPU16::NUM_PAGES/32, 0);
+
+    hooks.fetch = NULL;
+    hooks.read = NULL;
+    hooks.write = onWrite;
+    hooks.interrupt = NULL;
+    hooks.data = this;
+    hooks.write_pages = pages;
+
+    callback = NULL;
+    callback_data = NULL;
+}
+
+/*
+ * The hooks to attach to the cpu with DCPU16::setHooks(). Only writes made
+ * while it is stepped with step<DCPU16::CallbackHooks>() are seen.
+ */
+const ExecutionHooks* WatchList::getHooks() const
+{
+    return &hooks;
+}
+
+/*
+ * Sets the function flush() reports hits to.
+ */
+void WatchList::setCallback(Callback callback, void *data)
+{
+    this->callback = callback;
+    callback_data = data;
+}
+
+/*
+ * Watches the words from first to last, inclusive. Pending hits are
+ * flushed first.
+ *
+ * @return false if first is past last or the range is already watched.
+ */
+bool WatchList::add(uint16_t first, uint16_t last)
+{
+    if(first > last)
+        return false;
+
+    Hit watch = makeRange(first, last);
+    std::vector<Hit>::iterator it = std::lower_bound(watches.begin(), watches.end(), watch, rangeLess);
+    if(it != watches.end() && it->first == first && it->last == last)
+        return false;
+
+    flush();
+    watches.insert(it, watch);
+    rebuild();
+    return true;
+}
+
+/*
+ * Stops watching a range added with the same addresses. Pending hits are
+ * flushed first.
+ *
+ * @return false if the range isn't watched.
+ */
+bool WatchList::remove(uint16_t first, uint16_t last)
+{
+    Hit watch = makeRange(first, last);
+    std::vector<Hit>::iterator it = std::lower_bound(watches.begin(), watches.end(), watch, rangeLess);
+    if(it == watches.end() || it->first != first || it->last != last)
+        return false;
+
+    flush();
+    watches.erase(it);
+    rebuild();
+    return true;
+}
+
+/*
+ * Counts a write to address in every range containing it. Subtrees whose
+ * ranges all end before address are skipped, and the search stops at the
+ * first watch starting after it.
+ */
+void WatchList::write(uint16_t address)
+{
+    size_t begin = 0;
+    size_t end = watches.size();
+
+    /* subtrees left of the path still to search. */
+    size_t stack[64];
+    int depth = 0;
+
+    while(true)
+    {
+        if(begin < end)
+        {
+            size_t mid = begin + (end - begin) / 2;
+            if(max_last[mid] >= address)
+            {
+                /* search the left subtree first and come back for mid. */
+                stack[depth++] = mid;
+                stack[depth++] = end;
+                end = mid;
+                continue;
+            }
+        }
+
+        if(depth == 0)
+            break;
+
+        end = stack[--depth];
+        size_t mid = stack[--depth];
+
+        Hit &watch = watches[mid];
+        if(watch.first > address)
+            break;
+
+        if(address <= watch.last)
+        {
+            if(watch.writes++ == 0)
+            {
+                watch.low = address;
+                watch.high = address;
+                hits.push_back(mid);
+            }
+
+            watch.low = std::min(watch.low, address);
+            watch.high = std::max(watch.high, address);
+        }
+
+        begin = mid + 1;
+    }
+}
+
+/*
+ * Reports each range written since the last flush to the callback, in the
+ * order they were first written, and clears the hits.
+ */
+void WatchList::flush()
+{
+    for(size_t i = 0; i < hits.size(); i++)
+    {
+        Hit &watch = watches[hits[i]];
+
+        if(callback)
+            callback(watch, callback_data);
+
+        watch.writes = 0;
+    }
+
+    hits.clear();
+}
+
+/*
+ * Recomputes the tree and the watched pages after the watches changed.
+ */
+void WatchList::rebuild()
+{
+    max_last.resize(watches.size());
+    buildTree(0, watches.size());
+
+    std::fill(pages, pages + DCPU16::NUM_PAGES/32, 0);
+
+    for(size_t i = 0; i < watches.size(); i++)
+    {
+        int first = watches[i].first >> DCPU16::PAGE_SHIFT;
+        int last = watches[i].last >> DCPU16::PAGE_SHIFT;
+
+        for(int page = first; page <= last; page++)
+            pages[page / 32] |= 1u << (page % 32);
+    }
+}
+
+/*
+ * @return The highest last address in the subtree of watches begin to end.
+ */
+uint16_t WatchList::buildTree(size_t begin, size_t end)
+{
+    if(begin >= end)
+        return 0;
+
+    size_t mid = begin + (end - begin) / 2;
+    uint16_t last = watches[mid].last;
+
+    last = std::max(last, buildTree(begin, mid));
+    last = std::max(last, buildTree(mid + 1, end));
+
+    max_last[mid] = last;
+    return last;
+}
+
+void WatchList::onWrite(DCPU16 *, uint16_t address, uint16_t, void *data)
+{
+    static_cast<WatchList*>(data)->write(address);
+}
@@ -0,0 +1,90 @@
+#ifndef WATCH_LIST_H
+#define WATCH_LIST_H
+
+#include <vector>
+#include "../dcpu16/dcpu16.h"
+
+/*
+ * Watches address ranges for writes by the program.
+ *
+ * The list is attached to a cpu through its ExecutionHooks, whose write
+ * filter is the set of pages any range touches, so writes to other pages
+ * never leave the cpu. Writes to watched pages are looked up in an
+ * interval tree and counted per range. flush() reports the ranges written
+ * since the previous flush, once per range, so a loop filling a buffer
+ * makes one callback rather than one per word.
+ */
+class WatchList
+{
+/*---------------------------------------------------------------------------
+ * Types
+ *--------------------------------------------------------------------------*/
+public:
+    struct Hit
+    {
+        /* The watched range. */
+        uint16_t first;
+        uint16_t last;
+
+        /* Lowest and highest address written in the range. */
+        uint16_t low;
+        uint16_t high;
+
+        uint32_t writes;
+    };
+
+    typedef void (*Callback)(const Hit &hit, void *data);
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    /*
+     * Sorted by first address. Hits collect here until they are flushed.
+     */
+    std::vector<Hit> watches;
+
+    /*
+     * The sorted watches form a balanced tree, each range of them rooted
+     * at its middle watch. max_last[i] is the highest last address in the
+     * subtree rooted at watch i.
+     */
+    std::vector<uint16_t> max_last;
+
+    /* Indices of the watches hit since the last flush. */
+    std::vector<size_t> hits;
+
+    uint32_t pages[DCPU16::NUM_PAGES / 32];
+    ExecutionHooks hooks;
+
+    Callback callback;
+    void *callback_data;
+
+
+/*---------------------------------------------------------------------------
+ * Construct/Destruct
+ *--------------------------------------------------------------------------*/
+public:
+                        WatchList();
+
+    const ExecutionHooks* getHooks() const;
+    void                setCallback(Callback callback, void *data);
+
+
+/*---------------------------------------------------------------------------
+ * Watches
+ *--------------------------------------------------------------------------*/
+public:
+    bool                add(uint16_t first, uint16_t last);
+    bool                remove(uint16_t first, uint16_t last);
+    void                write(uint16_t address);
+    void                flush();
+
+private:
+    void                rebuild();
+    uint16_t            buildTree(size_t begin, size_t end);
+    static void         onWrite(DCPU16 *dcpu, uint16_t address, uint16_t value, void *data);
+};
+
+#endif /* WATCH_LIST_H */
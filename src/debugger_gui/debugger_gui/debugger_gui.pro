@@ -13,14 +13,33 @@ TEMPLATE = app
 SOURCES += main.cpp\
         mainwindow.cpp \
     ../../debugger/debugger.cpp \
+    ../../debugger/emulator_thread.cpp \
+    ../../debugger/watch_list.cpp \
     ../../dcpu16/dcpu16.cpp \
+    ../../dcpu16/input_log.cpp \
+    ../../assembler/assemble.cpp \
+    ../../disassembler/disassembler.cpp \
+    ../../disassembler/control_flow.cpp \
+    ../../disassembler/debug_info.cpp \
     memory_view.cpp \
+    disassembly_view.cpp \
+    heatmap_view.cpp \
     gui_utils.cpp
 
 HEADERS  += mainwindow.h \
     ../../debugger/debugger.h \
+    ../../debugger/emulator_thread.h \
+    ../../debugger/watch_list.h \
     ../../dcpu16/dcpu16.h \
+    ../../dcpu16/arithmetic.h \
+    ../../dcpu16/input_log.h \
+    ../../assembler/assemble.h \
+    ../../disassembler/disassembler.h \
+    ../../disassembler/control_flow.h \
+    ../../disassembler/debug_info.h \
     memory_view.h \
+    disassembly_view.h \
+    heatmap_view.h \
     gui_utils.h
 
 FORMS    += mainwindow.ui
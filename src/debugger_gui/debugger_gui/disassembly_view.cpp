@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <QFontMetrics>
+#include <QPainter>
+#include "../../debugger/emulator_thread.h"
+#include "disassembly_view.h"
+
+DisassemblyView::DisassemblyView(QWidget *parent)
+: QWidget(parent)
+{
+    emulator = NULL;
+    debug_info = NULL;
+
+    color_row0.setRgb(0x76DB66);
+    color_row1.setRgb(0xC7FEBE);
+    color_program_counter.setRgb(0x6AA0D8);
+
+    font = QFont("Terminus");
+    QFontMetrics metrics(font);
+
+    x_pad = 4;
+    y_pad = 4;
+    row_height = metrics.height() + y_pad*2;
+
+    painted_pc = 0;
+}
+
+void DisassemblyView::setEmulator(EmulatorThread *emulator)
+{
+    this->emulator = emulator;
+    rows.clear();
+    window.clear();
+    snapshotChanged();
+}
+
+/*
+ * Sets the debug info labels are taken from, or NULL for none. The info
+ * must stay open while the view uses it.
+ */
+void DisassemblyView::setDebugInfo(const DebugInfo *info)
+{
+    debug_info = info;
+    rows.clear();
+    window.clear();
+    snapshotChanged();
+}
+
+int DisassemblyView::visibleRows() const
+{
+    return height() / row_height + 1;
+}
+
+/*
+ * Drops rows the snapshot's writes touched, moves the window if PC left it
+ * and repaints if anything visible changed.
+ */
+void DisassemblyView::snapshotChanged()
+{
+    if(!emulator)
+        return;
+
+    const DCPU16 &dcpu = emulator->getSnapshot().dcpu;
+    bool changed = invalidate(dcpu);
+
+    if(rows.size() > MAX_CACHED_ROWS)
+    {
+        rows.clear();
+        changed = true;
+    }
+
+    changed = layoutWindow(dcpu.memoryPointer(), dcpu.pc) || changed;
+
+    if(changed || dcpu.pc != painted_pc)
+        update();
+}
+
+/*
+ * Erases cached rows that overlap dirty pages. Instructions are up to three
+ * words long, so rows starting two words before a page can overlap it.
+ *
+ * @return true if a visible row was erased.
+ */
+bool DisassemblyView::invalidate(const DCPU16 &dcpu)
+{
+    for(int page = 0; page < DCPU16::NUM_PAGES; page++)
+    {
+        if(!dcpu.isPageDirty(page))
+            continue;
+
+        uint32_t first = uint32_t(page) << DCPU16::PAGE_SHIFT;
+        uint32_t last = first + DCPU16::PAGE_SIZE - 1;
+
+        if(first == 0)
+            erase(DCPU16::MEMORY_SIZE - 2, DCPU16::MEMORY_SIZE - 1);
+        else
+            first -= 2;
+
+        erase(first, last);
+    }
+
+    for(size_t i = 0; i < window.size(); i++)
+        if(rows.find(window[i]) == rows.end())
+            return true;
+
+    return false;
+}
+
+void DisassemblyView::erase(uint32_t first, uint32_t last)
+{
+    rows.erase(rows.lower_bound(uint16_t(first)), rows.upper_bound(uint16_t(last)));
+}
+
+/*
+ * Keeps the window while PC is in it and above the last CONTEXT_ROWS rows.
+ * Otherwise the window restarts a few instructions before PC, found by
+ * decoding forward from earlier addresses until one lines up with PC.
+ *
+ * @return true if the window changed.
+ */
+bool DisassemblyView::layoutWindow(const uint16_t *mem, uint16_t pc)
+{
+    size_t count = visibleRows();
+
+    if(window.size() == count)
+    {
+        std::vector<uint16_t>::iterator it = std::find(window.begin(), window.end(), pc);
+        bool intact = true;
+
+        for(size_t i = 0; i < window.size() && intact; i++)
+            intact = rows.find(window[i]) != rows.end();
+
+        if(intact && it != window.end() && size_t(it - window.begin()) + CONTEXT_ROWS < count)
+            return false;
+    }
+
+    std::vector<uint16_t> next;
+
+    for(int back = CONTEXT_ROWS * 3; back > 0; back--)
+    {
+        std::vector<uint16_t> chain;
+        uint16_t address = uint16_t(pc - back);
+
+        while(address != pc && uint16_t(pc - address) <= back)
+        {
+            chain.push_back(address);
+            address = uint16_t(address + getRow(mem, address).inst.length);
+        }
+
+        if(address == pc)
+        {
+            size_t skip = chain.size() > CONTEXT_ROWS ? chain.size() - CONTEXT_ROWS : 0;
+            next.assign(chain.begin() + skip, chain.end());
+            break;
+        }
+    }
+
+    uint16_t address = pc;
+    while(next.size() < count)
+    {
+        next.push_back(address);
+        address = uint16_t(address + getRow(mem, address).inst.length);
+    }
+
+    if(next == window)
+        return false;
+
+    window.swap(next);
+    return true;
+}
+
+/*
+ * @return The cached row at address, decoding it if needed.
+ */
+const DisassemblyView::Row& DisassemblyView::getRow(const uint16_t *mem, uint16_t address)
+{
+    std::map<uint16_t, Row>::iterator it = rows.find(address);
+    if(it != rows.end())
+        return it->second;
+
+    Row &row = rows[address];
+    char buffer[Disassembler::MAX_FORMAT_LENGTH];
+
+    Disassembler::decode(mem, DCPU16::MEMORY_SIZE, address, &row.inst);
+    Disassembler::format(row.inst, buffer);
+
+    const char *label = debug_info ? debug_info->findLabel(address) : NULL;
+    if(label)
+        row.text.setText(QString(label) + ": " + buffer);
+    else
+        row.text.setText(QString(buffer));
+
+    return row;
+}
+
+void DisassemblyView::paintEvent(QPaintEvent *)
+{
+    if(!emulator)
+        return;
+
+    QPainter paint(this);
+    paint.setFont(font);
+
+    uint16_t pc = emulator->getSnapshot().dcpu.pc;
+
+    for(size_t i = 0; i < window.size(); i++)
+    {
+        QRectF rect(0, row_height*i, width(), row_height);
+
+        if(window[i] == pc)
+            paint.fillRect(rect, color_program_counter);
+        else
+            paint.fillRect(rect, i%2 ? color_row0 : color_row1);
+
+        std::map<uint16_t, Row>::const_iterator it = rows.find(window[i]);
+        if(it != rows.end())
+            paint.drawStaticText(x_pad, y_pad + row_height*i, it->second.text);
+    }
+
+    painted_pc = pc;
+}
+
+void DisassemblyView::resizeEvent(QResizeEvent *)
+{
+    snapshotChanged();
+}
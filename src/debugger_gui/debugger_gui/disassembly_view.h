@@ -0,0 +1,78 @@
+#ifndef DISASSEMBLY_VIEW_H
+#define DISASSEMBLY_VIEW_H
+
+#include <map>
+#include <vector>
+#include <QWidget>
+#include <QStaticText>
+#include <QColor>
+#include <QFont>
+#include "../../disassembler/disassembler.h"
+#include "../../disassembler/debug_info.h"
+
+class EmulatorThread;
+
+
+/*
+ * Shows the instructions around PC. Only the visible window is decoded.
+ * Decoded rows are cached by address and dropped when a snapshot reports
+ * their page was written, so a running program only re-decodes what it
+ * modifies. With debug info, rows at a label start with the label.
+ */
+class DisassemblyView : public QWidget
+{
+    //Q_OBJECT
+
+private:
+    enum
+    {
+        /* Rows kept above PC. */
+        CONTEXT_ROWS = 4,
+
+        /* The cache is flushed when it grows past this. */
+        MAX_CACHED_ROWS = 4096,
+    };
+
+    struct Row
+    {
+        Disassembler::Instruction inst;
+        QStaticText text;
+    };
+
+    EmulatorThread *emulator;
+    const DebugInfo *debug_info;
+    QColor color_row0;
+    QColor color_row1;
+    QColor color_program_counter;
+
+    QFont font;
+    int x_pad, y_pad;
+    int row_height;
+
+    std::map<uint16_t, Row> rows;
+
+    /* Addresses of the visible rows. */
+    std::vector<uint16_t> window;
+    uint16_t painted_pc;
+
+public:
+    DisassemblyView(QWidget *parent = NULL);
+
+    void setEmulator(EmulatorThread *emulator);
+    void setDebugInfo(const DebugInfo *info);
+
+    void snapshotChanged();
+
+protected:
+    void paintEvent(QPaintEvent *evt);
+    void resizeEvent(QResizeEvent *evt);
+
+private:
+    int  visibleRows() const;
+    bool layoutWindow(const uint16_t *mem, uint16_t pc);
+    bool invalidate(const DCPU16 &dcpu);
+    void erase(uint32_t first, uint32_t last);
+    const Row& getRow(const uint16_t *mem, uint16_t address);
+};
+
+#endif // DISASSEMBLY_VIEW_H
@@ -0,0 +1,63 @@
+#include <QPainter>
+#include "../../debugger/emulator_thread.h"
+#include "heatmap_view.h"
+
+/*
+ * @return The brightness for count accesses, 16 steps per doubling.
+ */
+static int level(uint16_t count)
+{
+    if(!count)
+        return 0;
+
+    int bits = 32 - __builtin_clz(count);
+    return bits >= 16 ? 255 : bits * 16;
+}
+
+HeatmapView::HeatmapView(QWidget *parent)
+: QWidget(parent), image(256, 256, QImage::Format_RGB32)
+{
+    emulator = NULL;
+    image.fill(0);
+}
+
+/*
+ * Counting starts as soon as the view is attached.
+ */
+void HeatmapView::setEmulator(EmulatorThread *emulator)
+{
+    this->emulator = emulator;
+    emulator->countAccesses(true);
+    snapshotChanged();
+}
+
+void HeatmapView::snapshotChanged()
+{
+    if(!emulator)
+        return;
+
+    const AccessCounters *counters = emulator->getSnapshot().dcpu.access_counters;
+    if(!counters)
+        return;
+
+    for(int y = 0; y < 256; y++)
+    {
+        QRgb *line = reinterpret_cast<QRgb*>(image.scanLine(y));
+
+        for(int x = 0; x < 256; x++)
+        {
+            int address = y*256 + x;
+            line[x] = qRgb(level(counters->writes[address]),
+                           level(counters->reads[address]),
+                           level(counters->executes[address]));
+        }
+    }
+
+    update();
+}
+
+void HeatmapView::paintEvent(QPaintEvent *)
+{
+    QPainter paint(this);
+    paint.drawImage(rect(), image);
+}
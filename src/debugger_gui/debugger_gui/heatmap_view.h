@@ -0,0 +1,34 @@
+#ifndef HEATMAP_VIEW_H
+#define HEATMAP_VIEW_H
+
+#include <QWidget>
+#include <QImage>
+
+class EmulatorThread;
+
+
+/*
+ * Shows how often each word of memory is accessed, one pixel per word with
+ * 256 words to a row. Writes are red, reads green and executes blue, on a
+ * log scale so both hot loops and occasional accesses show up.
+ */
+class HeatmapView : public QWidget
+{
+    //Q_OBJECT
+
+private:
+    EmulatorThread *emulator;
+    QImage image;
+
+public:
+    HeatmapView(QWidget *parent = NULL);
+
+    void setEmulator(EmulatorThread *emulator);
+
+    void snapshotChanged();
+
+protected:
+    void paintEvent(QPaintEvent *evt);
+};
+
+#endif // HEATMAP_VIEW_H
@@ -6,12 +6,12 @@
 class InfoWidgetItem : public QTableWidgetItem
 {
 protected:
-    Debugger *debugger;
+    EmulatorThread *emulator;
 
 public:
-    InfoWidgetItem(Debugger *debugger)
+    InfoWidgetItem(EmulatorThread *emulator)
     {
-        this->debugger = debugger;
+        this->emulator = emulator;
         setWritable(false);
     }
 
@@ -34,15 +34,15 @@ public:
     int rw_id;
 
 public:
-    ReadOnlyWidgetItem(Debugger *debugger, int rw_id)
-        : InfoWidgetItem(debugger)
+    ReadOnlyWidgetItem(EmulatorThread *emulator, int rw_id)
+        : InfoWidgetItem(emulator)
     {
         this->rw_id = rw_id;
     }
 
     virtual void update()
     {
-        uint16_t value = debugger->getDCPU().read(rw_id);
+        uint16_t value = emulator->getSnapshot().dcpu.read(rw_id);
         setText(hexstr(value));
     }
 };
@@ -50,8 +50,8 @@ public:
 class ReadWriteWidgetItem : public ReadOnlyWidgetItem
 {
 public:
-    ReadWriteWidgetItem(Debugger *debugger, int rw_id)
-        : ReadOnlyWidgetItem(debugger, rw_id)
+    ReadWriteWidgetItem(EmulatorThread *emulator, int rw_id)
+        : ReadOnlyWidgetItem(emulator, rw_id)
     {
         setWritable(true);
     }
@@ -69,7 +69,7 @@ public:
 
         if(ok && 0 <= integer && integer <= 0xFFFF)
         {
-            debugger->getDCPU().write(rw_id, integer);
+            emulator->write(rw_id, integer);
             //print confirmation to gui console box thing
         }
         else
@@ -82,15 +82,15 @@ public:
 class CyclesWidgetItem : public InfoWidgetItem
 {
 public:
-    CyclesWidgetItem(Debugger *debugger)
-        : InfoWidgetItem(debugger)
+    CyclesWidgetItem(EmulatorThread *emulator)
+        : InfoWidgetItem(emulator)
     {
 
     }
 
     void update()
     {
-        uint64_t value = debugger->getDCPU().getCycles();
+        uint64_t value = emulator->getSnapshot().dcpu.getCycles();
         setText(QString::number(value));
     }
 };
@@ -102,8 +102,8 @@ private:
     QColor error_color;
 
 public:
-    ErrorWidgetItem(Debugger *debugger)
-        : InfoWidgetItem(debugger)
+    ErrorWidgetItem(EmulatorThread *emulator)
+        : InfoWidgetItem(emulator)
     {
         no_error_color.setRgb(0xC7FEBE);
         error_color.setRgb(0xDE6770);
@@ -111,8 +111,9 @@ public:
 
     void update()
     {
-        int err = debugger->getDCPU().getError();
-        QString err_str = debugger->getDCPU().getErrorString(err);
+        const DCPU16 &dcpu = emulator->getSnapshot().dcpu;
+        int err = dcpu.getError();
+        QString err_str = dcpu.getErrorString(err);
 
         if(err_str.startsWith("ERROR_"))
             err_str.remove(0, 6);
@@ -135,36 +136,36 @@ MainWindow::MainWindow(QWidget *parent) :
 
     ui->setupUi(this);
 
-    connect(&run_timer, SIGNAL(timeout()), this, SLOT(pumpCPU()));
+    connect(&frame_timer, SIGNAL(timeout()), this, SLOT(pullSnapshot()));
 
     ui->registers_table->setColumnCount(2);
     ui->registers_table->setRowCount(0);
 
-    addInfoRow("A",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_0));
-    addInfoRow("B",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_1));
-    addInfoRow("C",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_2));
-    addInfoRow("I",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_3));
-    addInfoRow("J",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_4));
-    addInfoRow("K",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_5));
-    addInfoRow("X",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_6));
-    addInfoRow("Y",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_7));
-    addInfoRow("PC", new ReadWriteWidgetItem(&debugger, DCPU16::RW_PROGRAM_COUNTER));
-    addInfoRow("SP", new ReadWriteWidgetItem(&debugger, DCPU16::RW_STACK_POINTER));
-    addInfoRow("EX", new ReadWriteWidgetItem(&debugger, DCPU16::RW_EXCESS));
-
-    addInfoRow("[A]",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_PTR_0));
-    addInfoRow("[B]",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_PTR_1));
-    addInfoRow("[C]",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_PTR_2));
-    addInfoRow("[I]",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_PTR_3));
-    addInfoRow("[J]",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_PTR_4));
-    addInfoRow("[K]",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_PTR_5));
-    addInfoRow("[X]",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_PTR_6));
-    addInfoRow("[Y]",  new ReadWriteWidgetItem(&debugger, DCPU16::RW_REGISTER_PTR_7));
-    addInfoRow("[PC]", new ReadWriteWidgetItem(&debugger, DCPU16::RW_PROGRAM_COUNTER_PTR));
-    addInfoRow("[SP]", new ReadWriteWidgetItem(&debugger, DCPU16::RW_STACK_POINTER_PTR));
-
-    addInfoRow("Cycles", new CyclesWidgetItem(&debugger));
-    addInfoRow("Error",  new ErrorWidgetItem(&debugger));
+    addInfoRow("A",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_0));
+    addInfoRow("B",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_1));
+    addInfoRow("C",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_2));
+    addInfoRow("I",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_3));
+    addInfoRow("J",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_4));
+    addInfoRow("K",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_5));
+    addInfoRow("X",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_6));
+    addInfoRow("Y",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_7));
+    addInfoRow("PC", new ReadWriteWidgetItem(&emulator, DCPU16::RW_PROGRAM_COUNTER));
+    addInfoRow("SP", new ReadWriteWidgetItem(&emulator, DCPU16::RW_STACK_POINTER));
+    addInfoRow("EX", new ReadWriteWidgetItem(&emulator, DCPU16::RW_EXCESS));
+
+    addInfoRow("[A]",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_PTR_0));
+    addInfoRow("[B]",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_PTR_1));
+    addInfoRow("[C]",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_PTR_2));
+    addInfoRow("[I]",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_PTR_3));
+    addInfoRow("[J]",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_PTR_4));
+    addInfoRow("[K]",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_PTR_5));
+    addInfoRow("[X]",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_PTR_6));
+    addInfoRow("[Y]",  new ReadWriteWidgetItem(&emulator, DCPU16::RW_REGISTER_PTR_7));
+    addInfoRow("[PC]", new ReadWriteWidgetItem(&emulator, DCPU16::RW_PROGRAM_COUNTER_PTR));
+    addInfoRow("[SP]", new ReadWriteWidgetItem(&emulator, DCPU16::RW_STACK_POINTER_PTR));
+
+    addInfoRow("Cycles", new CyclesWidgetItem(&emulator));
+    addInfoRow("Error",  new ErrorWidgetItem(&emulator));
 
     ui->splitter->setStretchFactor(0, 30);
     ui->splitter->setStretchFactor(1, 1);
@@ -186,10 +187,14 @@ MainWindow::MainWindow(QWidget *parent) :
     };
 
 
-    //debugger.loadProgram(prog, 28);
-    debugger.loadProgram(prog_fib, sizeof(prog_fib)/sizeof(prog_fib[0]));
+    //emulator.getDebugger().loadProgram(prog, 28);
+    emulator.getDebugger().loadProgram(prog_fib, sizeof(prog_fib)/sizeof(prog_fib[0]));
 
-    ui->memory_view->setDebugger(&debugger);
+    ui->memory_view->setEmulator(&emulator);
+    ui->disassembly_view->setEmulator(&emulator);
+    ui->heatmap_view->setEmulator(&emulator);
+    emulator.start();
+    frame_timer.start(1000 / REFRESH_RATE);
     updateGUI();
 
     updating_gui = false;
@@ -228,45 +233,41 @@ void MainWindow::updateGUI()
     for(size_t i = 0; i < info_items.size(); i++)
         info_items[i]->update();
 
-    ui->memory_view->updateTexts();
-    //TODO only repaint if memory changed.
-    //TODO MemoryView should take care of determining if a repaint is necessary when updating texts.
-    ui->memory_view->repaint();
+    ui->memory_view->snapshotChanged();
+    ui->disassembly_view->snapshotChanged();
+    ui->heatmap_view->snapshotChanged();
 
     updating_gui = false;
 }
 
 void MainWindow::doStep(int step)
 {
-    debugger.step(step);
-
-    if(debugger.getDCPU().getError())
-        stopCPU();
-
-    updateGUI();
+    emulator.step(step);
 }
 
 void MainWindow::runCPU()
 {
-    run_timer.start(0);
+    emulator.run();
 }
 
 void MainWindow::stopCPU()
 {
-    run_timer.stop();
+    emulator.pause();
 }
 
-void MainWindow::pumpCPU()
+/*
+ * Called at the display refresh rate. The GUI is only updated when the
+ * emulator published a new snapshot.
+ */
+void MainWindow::pullSnapshot()
 {
-//    doStep(1000);
-    doStep(1);
-    //doStep(100000);
+    if(emulator.pollSnapshot())
+        updateGUI();
 }
 
 void MainWindow::reset()
 {
-    debugger.reset();
-    updateGUI();
+    emulator.reset();
 }
 
 void MainWindow::exit()
@@ -282,13 +283,17 @@ void MainWindow::on_actionOpen_triggered()
         open(path);
 }
 
+/*
+ * The edit is only queued for the emulator. The table is left as typed until
+ * the next snapshot shows the written value, redrawing now would show the
+ * old one.
+ */
 void MainWindow::on_registers_table_cellChanged(int row, int column)
 {
     if(column ==0 || updating_gui)
         return;
 
     static_cast<InfoWidgetItem*>(ui->registers_table->item(row, column))->onEdit();
-    updateGUI();
 }
 
 void MainWindow::on_playButton_clicked()            { runCPU(); }
@@ -5,7 +5,7 @@
 #include <QTimer>
 #include <QString>
 #include <vector>
-#include "../../debugger/debugger.h"
+#include "../../debugger/emulator_thread.h"
 
 namespace Ui {
 class MainWindow;
@@ -23,9 +23,14 @@ class MainWindow : public QMainWindow
  * Members
  *--------------------------------------------------------------------------*/
 private:
+    enum
+    {
+        REFRESH_RATE = 60,
+    };
+
     Ui::MainWindow *ui;
-    Debugger debugger;
-    QTimer run_timer;
+    EmulatorThread emulator;
+    QTimer frame_timer;
     std::vector<InfoWidgetItem*> info_items;
     bool updating_gui;
 
@@ -69,7 +74,7 @@ private:
  * Custom Slots
  *--------------------------------------------------------------------------*/
 private slots:
-    void pumpCPU();
+    void pullSnapshot();
 
 /*---------------------------------------------------------------------------
  * Automatic Slots
@@ -1,12 +1,14 @@
+#include <algorithm>
+#include <QFontMetrics>
 #include <QPainter>
-#include "../../debugger/debugger.h"
+#include "../../debugger/emulator_thread.h"
 #include "gui_utils.h"
 #include "memory_view.h"
 
 MemoryView::MemoryView(QWidget *parent)
 : QWidget(parent)
 {
-    debugger = NULL;
+    emulator = NULL;
     row_offset = 0;
     columns = 16;
 
@@ -25,33 +27,104 @@ MemoryView::MemoryView(QWidget *parent)
 
     color_program_counter.setRgb(0x6AA0D8);
     color_stack_pointer.setRgb(0xBF3030);
+
+    font = QFont("Terminus");
+    QFontMetrics metrics(font);
+
+    col_x_pad = 4;
+    col_y_pad = 4;
+    row_height = metrics.height() + col_y_pad*2;
+    col_width = metrics.width("0xFFFF") + col_x_pad*2;
+
+    cell_address = 0;
+    cells_valid = false;
+    painted_pc = 0;
+    painted_sp = 0;
 }
 
-void MemoryView::setDebugger(Debugger *debugger)
+void MemoryView::setEmulator(EmulatorThread *emulator)
 {
-    this->debugger = debugger;
-    updateTexts(true);
+    this->emulator = emulator;
+    refresh();
 }
 
-void MemoryView::updateTexts(bool force)
+/*
+ * Reformats and repaints every visible cell.
+ */
+void MemoryView::refresh()
 {
-    const uint16_t *mem = debugger->getDCPU().memoryPointer();
+    cells_valid = false;
+    update();
+}
 
-    for(int i = 0; i < DCPU16::MEMORY_SIZE; i++)
-        if(force|| mem[i] != known_memory[i])
-            mem_text[i].setText(hexstr(mem[i]));
+int MemoryView::visibleRows() const
+{
+    return height() / row_height + 1;
+}
+
+/*
+ * Repaints if anything visible changed since the previous snapshot.
+ */
+void MemoryView::snapshotChanged()
+{
+    if(!emulator)
+        return;
+
+    const DCPU16 &dcpu = emulator->getSnapshot().dcpu;
+    bool changed = !cells_valid ||
+                   dcpu.read(DCPU16::RW_PROGRAM_COUNTER) != painted_pc ||
+                   dcpu.read(DCPU16::RW_STACK_POINTER) != painted_sp;
+
+    int first = columns * row_offset;
+    int last = std::min(first + columns * visibleRows(), int(DCPU16::MEMORY_SIZE)) - 1;
+
+    for(int page = first >> DCPU16::PAGE_SHIFT; !changed && page <= last >> DCPU16::PAGE_SHIFT; page++)
+        changed = dcpu.isPageDirty(page);
+
+    if(changed)
+        update();
+}
+
+/*
+ * Formats the cells whose word changed since they were last formatted.
+ */
+void MemoryView::updateCells(const uint16_t *mem, int address, int count)
+{
+    if(!cells_valid || address != cell_address || count != int(cell_text.size()))
+    {
+        cell_text.resize(count);
+        cell_value.resize(count);
+        cell_address = address;
+
+        for(int i = 0; i < count; i++)
+        {
+            cell_value[i] = mem[address + i];
+            cell_text[i].setText(hexstr(cell_value[i]));
+        }
+
+        cells_valid = true;
+        return;
+    }
+
+    for(int i = 0; i < count; i++)
+    {
+        if(cell_value[i] != mem[address + i])
+        {
+            cell_value[i] = mem[address + i];
+            cell_text[i].setText(hexstr(cell_value[i]));
+        }
+    }
 }
 
 void MemoryView::paintEvent(QPaintEvent *)
 {
-    QPainter paint(this);
-    paint.setFont(QFont("Terminus"));
+    if(!emulator)
+        return;
 
-    int col_x_pad = 4, col_y_pad = 4;
-    int row_height = paint.fontMetrics().height() + col_y_pad*2;
-    int col_width = paint.fontMetrics().width("0xFFFF") + col_x_pad*2;
+    QPainter paint(this);
+    paint.setFont(font);
 
-    int rows = height() / row_height + 1;
+    int rows = visibleRows();
 
     for(int i = 0; i < rows; i++)
     {
@@ -75,11 +148,19 @@ void MemoryView::paintEvent(QPaintEvent *)
         paint.drawText(col_x_pad, col_y_pad + row_height*i, hexstr(uint16_t(address)));
     }
 
-    int pc = debugger->getDCPU().read(DCPU16::RW_PROGRAM_COUNTER);
-    int sp = debugger->getDCPU().read(DCPU16::RW_STACK_POINTER);
-    int row = 0, col = 0;
-    for(int mem_index = columns * row_offset; mem_index < DCPU16::MEMORY_SIZE; mem_index++)
+    const DCPU16 &dcpu = emulator->getSnapshot().dcpu;
+    int pc = dcpu.read(DCPU16::RW_PROGRAM_COUNTER);
+    int sp = dcpu.read(DCPU16::RW_STACK_POINTER);
+
+    int first = columns * row_offset;
+    int count = std::max(0, std::min(columns * rows, DCPU16::MEMORY_SIZE - first));
+    updateCells(dcpu.memoryPointer(), first, count);
+
+    for(int i = 0; i < count; i++)
     {
+        int mem_index = first + i;
+        int row = i / columns, col = i % columns;
+
         if(mem_index == pc && mem_index == sp)
         {
             paint.fillRect(QRectF(col_width*(col+1) + col_width/2, row_height*row, col_width/2, row_height), color_program_counter);
@@ -90,20 +171,11 @@ void MemoryView::paintEvent(QPaintEvent *)
         else if(mem_index == sp)
             paint.fillRect(QRectF(col_width*(col+1), row_height*row, col_width, row_height), color_stack_pointer);
 
-        //QRectF trect(col_width*(col+1), row_height*row, col_width, row_height);
-        //paint.drawStaticText(trect, Qt::AlignCenter, mem_text[mem_index]);
-
         int tx = col_x_pad + col_width + col_width * col;
         int ty = col_y_pad + row_height * row;
-        paint.drawStaticText(tx, ty, mem_text[mem_index]);
-
-        if(++col >= columns)
-        {
-            col = 0;
-            row++;
-
-            if(row > rows)
-                break;
-        }
+        paint.drawStaticText(tx, ty, cell_text[i]);
     }
+
+    painted_pc = uint16_t(pc);
+    painted_sp = uint16_t(sp);
 }
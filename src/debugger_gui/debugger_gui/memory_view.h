@@ -1,20 +1,27 @@
 #ifndef MEMORY_VIEW_H
 #define MEMORY_VIEW_H
 
+#include <vector>
 #include <QWidget>
 #include <QStaticText>
 #include <QColor>
+#include <QFont>
 #include "../../dcpu16/dcpu16.h"
 
-class Debugger;
+class EmulatorThread;
 
 
+/*
+ * Only the visible rows are formatted and painted. Each time a new snapshot
+ * is picked up, the view repaints only if a visible page was written or
+ * PC/SP moved.
+ */
 class MemoryView : public QWidget
 {
     //Q_OBJECT
 
 private:
-    Debugger *debugger;
+    EmulatorThread *emulator;
     int row_offset;
     int columns;
     QColor color_row0;
@@ -23,18 +30,37 @@ private:
     QColor color_column_overlay;
     QColor color_program_counter;
     QColor color_stack_pointer;
-    QStaticText mem_text[DCPU16::MEMORY_SIZE];
-    uint16_t known_memory[DCPU16::MEMORY_SIZE];
+
+    QFont font;
+    int col_x_pad, col_y_pad;
+    int row_height, col_width;
+
+    /*
+     * Text of the visible cells starting at cell_address, reformatted only
+     * when the word in memory no longer matches cell_value.
+     */
+    std::vector<QStaticText> cell_text;
+    std::vector<uint16_t> cell_value;
+    int cell_address;
+    bool cells_valid;
+
+    uint16_t painted_pc;
+    uint16_t painted_sp;
 
 public:
     MemoryView(QWidget *parent = NULL);
 
-    void setDebugger(Debugger *debugger);
+    void setEmulator(EmulatorThread *emulator);
 
-    void updateTexts(bool force=false);
+    void refresh();
+    void snapshotChanged();
 
 protected:
     void paintEvent(QPaintEvent *evt);
+
+private:
+    int  visibleRows() const;
+    void updateCells(const uint16_t *mem, int address, int count);
 };
 
 #endif // MEMORY_VIEW_H
@@ -0,0 +1,299 @@
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "m35fd.h"
+
+
+M35FD::M35FD()
+{
+    dcpu = NULL;
+    fd = -1;
+    image = NULL;
+    image_bytes = 0;
+    image_sectors = 0;
+    write_protected = false;
+
+    state = STATE_NO_MEDIA;
+    error = ERROR_NONE;
+    interrupt_message = 0;
+    track = 0;
+
+    transfer_write = false;
+    transfer_sector = 0;
+    transfer_address = 0;
+}
+
+M35FD::~M35FD()
+{
+    unmap();
+}
+
+/*
+ * Attaches the drive to a cpu. The drive keeps a pointer to the cpu so media
+ * changes can raise interrupts.
+ */
+bool M35FD::attach(DCPU16 *dcpu, uint16_t *device_id)
+{
+    Device device;
+    device.getHardwareID      = getHardwareID;
+    device.getHardwareVersion = getHardwareVersion;
+    device.getManufacturerID  = getManufacturerID;
+    device.interrupt          = interrupt;
+    device.reset              = reset;
+    device.data               = this;
+
+    if(!dcpu->attachDevice(device, device_id))
+        return false;
+
+    this->dcpu = dcpu;
+    return true;
+}
+
+/*
+ * Maps a disk image and inserts it into the drive. Images shorter than a full
+ * disk are accepted, reads and writes past their end fail with
+ * ERROR_BAD_SECTOR.
+ *
+ * @param path              Path to the image file.
+ * @param write_protected   If true the image is mapped read only.
+ *
+ * @return false if the image couldn't be mapped.
+ */
+bool M35FD::insert(const char *path, bool write_protected)
+{
+    eject();
+
+    int flags = write_protected ? O_RDONLY : O_RDWR;
+    int prot  = write_protected ? PROT_READ : PROT_READ | PROT_WRITE;
+
+    fd = open(path, flags);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)(SECTOR_SIZE * sizeof(uint16_t)))
+    {
+        unmap();
+        return false;
+    }
+
+    size_t max_bytes = size_t(NUM_SECTORS) * SECTOR_SIZE * sizeof(uint16_t);
+    image_bytes = std::min(size_t(st.st_size), max_bytes);
+    image_sectors = uint16_t(image_bytes / (SECTOR_SIZE * sizeof(uint16_t)));
+
+    void *ptr = mmap(NULL, image_bytes, prot, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED)
+    {
+        unmap();
+        return false;
+    }
+
+    image = static_cast<uint16_t*>(ptr);
+    this->write_protected = write_protected;
+    track = 0;
+
+    setStatus(readyState(), ERROR_NONE);
+    return true;
+}
+
+/*
+ * Ejects the current disk. A transfer in progress fails with ERROR_EJECT.
+ */
+void M35FD::eject()
+{
+    if(!image && fd < 0)
+        return;
+
+    bool busy = state == STATE_BUSY;
+
+    if(busy && dcpu)
+        dcpu->cancelEvents(this);
+
+    unmap();
+    setStatus(STATE_NO_MEDIA, busy ? uint16_t(ERROR_EJECT) : error);
+}
+
+uint16_t M35FD::getState() const
+{
+    return state;
+}
+
+uint16_t M35FD::getError() const
+{
+    return error;
+}
+
+uint32_t M35FD::getHardwareID()
+{
+    return HARDWARE_ID;
+}
+
+uint16_t M35FD::getHardwareVersion()
+{
+    return HARDWARE_VERSION;
+}
+
+uint32_t M35FD::getManufacturerID()
+{
+    return MANUFACTURER_ID;
+}
+
+int M35FD::interrupt(DCPU16 *dcpu, void *data)
+{
+    M35FD *drive = static_cast<M35FD*>(data);
+
+    switch(dcpu->reg[DCPU16::REG_A])
+    {
+    case CMD_POLL:
+        dcpu->reg[DCPU16::REG_B] = drive->state;
+        dcpu->reg[DCPU16::REG_C] = drive->error;
+        drive->error = ERROR_NONE;
+        break;
+
+    case CMD_SET_INTERRUPT:
+        drive->interrupt_message = dcpu->reg[DCPU16::REG_X];
+        break;
+
+    case CMD_READ:
+        dcpu->reg[DCPU16::REG_B] = drive->beginTransfer(dcpu, false) ? 1 : 0;
+        break;
+
+    case CMD_WRITE:
+        dcpu->reg[DCPU16::REG_B] = drive->beginTransfer(dcpu, true) ? 1 : 0;
+        break;
+
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+void M35FD::reset(DCPU16 *, void *data)
+{
+    M35FD *drive = static_cast<M35FD*>(data);
+
+    /* the cpu drops pending events on reset. */
+    drive->interrupt_message = 0;
+    drive->error = ERROR_NONE;
+    drive->state = drive->readyState();
+}
+
+/*
+ * Starts reading or writing sector X at memory address Y. The transfer
+ * completes after the seek and transfer time has passed.
+ */
+bool M35FD::beginTransfer(DCPU16 *dcpu, bool write)
+{
+    uint16_t sector = dcpu->reg[DCPU16::REG_X];
+
+    if(state == STATE_BUSY)
+    {
+        setStatus(state, ERROR_BUSY);
+        return false;
+    }
+
+    if(state == STATE_NO_MEDIA)
+    {
+        setStatus(state, ERROR_NO_MEDIA);
+        return false;
+    }
+
+    if(write && write_protected)
+    {
+        setStatus(state, ERROR_PROTECTED);
+        return false;
+    }
+
+    if(sector >= image_sectors)
+    {
+        setStatus(state, ERROR_BAD_SECTOR);
+        return false;
+    }
+
+    uint16_t target_track = sector / SECTORS_PER_TRACK;
+    uint64_t cycles = CYCLES_PER_SECTOR;
+    cycles += uint64_t(std::abs(int(target_track) - int(track))) * CYCLES_PER_TRACK_SEEK;
+
+    transfer_write   = write;
+    transfer_sector  = sector;
+    transfer_address = dcpu->reg[DCPU16::REG_Y];
+    track            = target_track;
+
+    setStatus(STATE_BUSY, error);
+    dcpu->scheduleEvent(cycles, transferComplete, this);
+    return true;
+}
+
+void M35FD::transferComplete(DCPU16 *dcpu, void *data)
+{
+    M35FD *drive = static_cast<M35FD*>(data);
+
+    drive->copySector(dcpu);
+    drive->setStatus(drive->readyState(), drive->error);
+}
+
+/*
+ * Copies the pending sector between the image and the cpu's memory. A
+ * written sector that wraps around the end of memory needs a second copy.
+ * Sectors read go through the cpu so they are recorded with its input.
+ */
+void M35FD::copySector(DCPU16 *dcpu)
+{
+    uint16_t *sector = image + size_t(transfer_sector) * SECTOR_SIZE;
+    uint16_t *mem = dcpu->mem + transfer_address;
+
+    size_t first = std::min(size_t(SECTOR_SIZE), size_t(DCPU16::MEMORY_SIZE - transfer_address));
+    size_t rest  = SECTOR_SIZE - first;
+
+    if(transfer_write)
+    {
+        memcpy(sector, mem, first * sizeof(uint16_t));
+        if(rest)
+            memcpy(sector + first, dcpu->mem, rest * sizeof(uint16_t));
+    }
+    else
+    {
+        dcpu->deviceWrite(transfer_address, sector, SECTOR_SIZE);
+    }
+}
+
+/*
+ * Updates the state and error, sending the interrupt message if either
+ * changed.
+ */
+void M35FD::setStatus(uint16_t state, uint16_t error)
+{
+    bool changed = state != this->state || error != this->error;
+
+    this->state = state;
+    this->error = error;
+
+    if(changed && interrupt_message && dcpu)
+        dcpu->interrupt(interrupt_message);
+}
+
+uint16_t M35FD::readyState() const
+{
+    if(!image)
+        return STATE_NO_MEDIA;
+    return write_protected ? STATE_READY_WP : STATE_READY;
+}
+
+void M35FD::unmap()
+{
+    if(image)
+        munmap(image, image_bytes);
+    if(fd >= 0)
+        close(fd);
+
+    fd = -1;
+    image = NULL;
+    image_bytes = 0;
+    image_sectors = 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Mackapar 3.5" floppy drive (M35FD).
+ *
+ * Disk images are memory mapped and sectors are copied straight between the
+ * mapping and the cpu's memory when a transfer completes. Images are stored
+ * as 1440 sectors of 512 words in host byte order.
+ */
+
+#ifndef M35FD_H
+#define M35FD_H
+
+#include <cstddef>
+#include "../dcpu16/dcpu16.h"
+
+class M35FD
+{
+/*---------------------------------------------------------------------------
+ * Constants
+ *--------------------------------------------------------------------------*/
+public:
+    enum
+    {
+        HARDWARE_ID      = 0x4FD524C5,
+        HARDWARE_VERSION = 0x000B,
+        MANUFACTURER_ID  = 0x1EB37E91,
+    };
+
+    enum
+    {
+        SECTOR_SIZE       = 512,
+        SECTORS_PER_TRACK = 18,
+        NUM_TRACKS        = 80,
+        NUM_SECTORS       = SECTORS_PER_TRACK * NUM_TRACKS,
+    };
+
+    enum
+    {
+        CMD_POLL          = 0x0000,
+        CMD_SET_INTERRUPT = 0x0001,
+        CMD_READ          = 0x0002,
+        CMD_WRITE         = 0x0003,
+    };
+
+    enum
+    {
+        STATE_NO_MEDIA = 0x0000,
+        STATE_READY    = 0x0001,
+        STATE_READY_WP = 0x0002,
+        STATE_BUSY     = 0x0003,
+    };
+
+    enum
+    {
+        ERROR_NONE       = 0x0000,
+        ERROR_BUSY       = 0x0001,
+        ERROR_NO_MEDIA   = 0x0002,
+        ERROR_PROTECTED  = 0x0003,
+        ERROR_EJECT      = 0x0004,
+        ERROR_BAD_SECTOR = 0x0005,
+        ERROR_BROKEN     = 0xFFFF,
+    };
+
+    /*
+     * Transfer timing at 100 kHz. The drive moves 30700 words per second and
+     * seeks take 2.4 ms per track.
+     */
+    enum
+    {
+        CYCLES_PER_SECTOR     = 1668,
+        CYCLES_PER_TRACK_SEEK = 240,
+    };
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    DCPU16   *dcpu;
+
+    int       fd;
+    uint16_t *image;
+    size_t    image_bytes;
+    uint16_t  image_sectors;
+    bool      write_protected;
+
+    uint16_t  state;
+    uint16_t  error;
+    uint16_t  interrupt_message;
+    uint16_t  track;
+
+    bool      transfer_write;
+    uint16_t  transfer_sector;
+    uint16_t  transfer_address;
+
+
+/*---------------------------------------------------------------------------
+ * Initialization
+ *--------------------------------------------------------------------------*/
+public:
+                        M35FD();
+                        ~M35FD();
+
+    bool                attach(DCPU16 *dcpu, uint16_t *device_id);
+
+
+/*---------------------------------------------------------------------------
+ * Media
+ *--------------------------------------------------------------------------*/
+public:
+    bool                insert(const char *path, bool write_protected);
+    void                eject();
+    uint16_t            getState() const;
+    uint16_t            getError() const;
+
+
+/*---------------------------------------------------------------------------
+ * Device Callbacks
+ *--------------------------------------------------------------------------*/
+private:
+    static uint32_t     getHardwareID();
+    static uint16_t     getHardwareVersion();
+    static uint32_t     getManufacturerID();
+    static int          interrupt(DCPU16 *dcpu, void *data);
+    static void         reset(DCPU16 *dcpu, void *data);
+    static void         transferComplete(DCPU16 *dcpu, void *data);
+
+    bool                beginTransfer(DCPU16 *dcpu, bool write);
+    void                copySector(DCPU16 *dcpu);
+    void                setStatus(uint16_t state, uint16_t error);
+    uint16_t            readyState() const;
+    void                unmap();
+};
+
+#endif /* M35FD_H */
@@ -0,0 +1,397 @@
+#include <algorithm>
+#include "control_flow.h"
+
+enum
+{
+    FLAG_START  = 0x01,
+    FLAG_CODE   = 0x02,
+    FLAG_LEADER = 0x04,
+};
+
+static bool overlapLess(const ControlFlowGraph::Overlap &a, const ControlFlowGraph::Overlap &b)
+{
+    return a.address < b.address;
+}
+
+
+/*
+ * Builds the graph. Blocks are sorted by their start address.
+ *
+ * @param words     Memory to follow.
+ * @param num_words Number of valid words in memory.
+ * @param entries   Addresses execution can start at.
+ */
+void ControlFlowGraph::build(const uint16_t *words, uint32_t num_words, const std::vector<uint16_t> &entries)
+{
+    clear();
+    flags.assign(DCPU16::MEMORY_SIZE, 0);
+
+    discover(words, num_words, entries);
+    buildBlocks(words, num_words);
+    findOverlaps(words, num_words);
+}
+
+void ControlFlowGraph::clear()
+{
+    blocks.clear();
+    edges.clear();
+    overlaps.clear();
+    flags.clear();
+}
+
+/*
+ * Follows flow from the entry points, marking instruction starts, code words
+ * and block leaders.
+ */
+void ControlFlowGraph::discover(const uint16_t *words, uint32_t num_words, const std::vector<uint16_t> &entries)
+{
+    std::vector<uint16_t> work(entries.rbegin(), entries.rend());
+    std::vector<Target> targets;
+
+    while(!work.empty())
+    {
+        uint32_t address = work.back();
+        work.pop_back();
+
+        if(address >= num_words)
+            continue;
+
+        flags[address] |= FLAG_LEADER;
+
+        while(address < num_words && !(flags[address] & FLAG_START))
+        {
+            Disassembler::Decoded inst;
+            Disassembler::decode(words, num_words, address, &inst);
+
+            flags[address] |= FLAG_START;
+            for(uint32_t i = address; i < address + inst.length && i < num_words; i++)
+                flags[i] |= FLAG_CODE;
+
+            targets.clear();
+            bool falls_through = getTargets(inst, words, num_words, &targets);
+            bool ends_block = !falls_through;
+
+            for(size_t i = 0; i < targets.size(); i++)
+            {
+                if(targets[i].type != EDGE_INTERRUPT)
+                    ends_block = true;
+
+                if(targets[i].address < num_words)
+                {
+                    flags[targets[i].address] |= FLAG_LEADER;
+                    work.push_back(targets[i].address);
+                }
+            }
+
+            if(!falls_through)
+                break;
+
+            address += inst.length;
+
+            if(ends_block && address < num_words)
+                flags[address] |= FLAG_LEADER;
+        }
+
+        /* joined an already decoded run, which starts a new block. */
+        if(address < num_words && (flags[address] & FLAG_START))
+            flags[address] |= FLAG_LEADER;
+    }
+}
+
+/*
+ * Splits the decoded code into blocks at leaders and connects them.
+ */
+void ControlFlowGraph::buildBlocks(const uint16_t *words, uint32_t num_words)
+{
+    std::vector< std::vector<Target> > block_targets;
+    std::vector<Target> targets;
+
+    for(uint32_t leader = 0; leader < num_words; leader++)
+    {
+        if(!(flags[leader] & FLAG_LEADER))
+            continue;
+
+        Block block;
+        block.start = uint16_t(leader);
+        block.length = 0;
+        block.num_instructions = 0;
+
+        std::vector<Target> exits;
+        uint32_t address = leader;
+
+        while(true)
+        {
+            Disassembler::Decoded inst;
+            Disassembler::decode(words, num_words, address, &inst);
+
+            block.length += inst.length;
+            block.num_instructions++;
+
+            targets.clear();
+            bool falls_through = getTargets(inst, words, num_words, &targets);
+            bool ends_block = !falls_through;
+
+            for(size_t i = 0; i < targets.size(); i++)
+            {
+                if(targets[i].type != EDGE_INTERRUPT)
+                    ends_block = true;
+                exits.push_back(targets[i]);
+            }
+
+            address += inst.length;
+
+            if(falls_through && address < num_words && (ends_block || (flags[address] & FLAG_LEADER)))
+            {
+                Target target;
+                target.address = uint16_t(address);
+                target.type = EDGE_FALLTHROUGH;
+                exits.push_back(target);
+                break;
+            }
+
+            if(ends_block || address >= num_words)
+                break;
+        }
+
+        blocks.push_back(block);
+        block_targets.push_back(exits);
+    }
+
+    for(size_t i = 0; i < blocks.size(); i++)
+        for(size_t j = 0; j < block_targets[i].size(); j++)
+            addEdge(i, block_targets[i][j].address, block_targets[i][j].type);
+}
+
+/*
+ * Records instruction starts that lie inside another decoded instruction,
+ * sorted by address.
+ */
+void ControlFlowGraph::findOverlaps(const uint16_t *words, uint32_t num_words)
+{
+    for(uint32_t address = 0; address < num_words; address++)
+    {
+        if(!(flags[address] & FLAG_START))
+            continue;
+
+        Disassembler::Decoded inst;
+        Disassembler::decode(words, num_words, address, &inst);
+
+        for(uint32_t i = address + 1; i < address + inst.length && i < num_words; i++)
+        {
+            if(!(flags[i] & FLAG_START))
+                continue;
+
+            Overlap overlap;
+            overlap.address = uint16_t(i);
+            overlap.instruction = uint16_t(address);
+            overlaps.push_back(overlap);
+        }
+    }
+
+    std::stable_sort(overlaps.begin(), overlaps.end(), overlapLess);
+}
+
+void ControlFlowGraph::addEdge(size_t from, uint16_t to, int type)
+{
+    const Block *block = findBlockFromAddress(to);
+    if(!block || block->start != to)
+        return;
+
+    Edge edge;
+    edge.from = from;
+    edge.to = size_t(block - &blocks[0]);
+    edge.type = type;
+
+    blocks[edge.from].successors.push_back(edges.size());
+    blocks[edge.to].predecessors.push_back(edges.size());
+    edges.push_back(edge);
+}
+
+/*
+ * Finds where an instruction can transfer control to.
+ *
+ * @param inst      Instruction to inspect.
+ * @param targets   Receives jump, call, skip and interrupt handler targets.
+ *
+ * @return true if execution can continue with the next instruction.
+ */
+bool ControlFlowGraph::getTargets(const Disassembler::Decoded &inst, const uint16_t *words, uint32_t num_words, std::vector<Target> *targets)
+{
+    const OperationInfo &op = DCPU16::getOperationInfo(inst.instruction);
+    const OperandInfo &a = DCPU16::getOperandInfo(inst.oa);
+    uint16_t next = uint16_t(inst.address + inst.length);
+
+    if(!(op.flags & DCPU16::OPERATION_VALID))
+        return false;
+
+    bool a_constant = false;
+    uint16_t a_value = 0;
+
+    if(DCPU16::MODE_LITERAL == a.mode)
+    {
+        a_constant = true;
+        a_value = a.literal;
+    }
+    else if(DCPU16::MODE_NEXT_WORD_LITERAL == a.mode)
+    {
+        a_constant = true;
+        a_value = inst.a_word;
+    }
+
+    Target target;
+
+    if(DCPU16::EXT != inst.op)
+    {
+        if(op.flags & DCPU16::OPERATION_CONDITIONAL)
+        {
+            target.address = getSkipTarget(words, num_words, next);
+            target.type = EDGE_SKIP;
+            targets->push_back(target);
+            return true;
+        }
+
+        bool writes_pc = (op.flags & DCPU16::OPERATION_WRITES) &&
+                         DCPU16::MODE_PC == DCPU16::getOperandInfo(inst.ob).mode;
+
+        if(!writes_pc)
+            return true;
+
+        target.type = EDGE_JUMP;
+
+        if(a_constant && DCPU16::SET == inst.op)
+            target.address = a_value;
+        else if(a_constant && DCPU16::ADD == inst.op)
+            target.address = uint16_t(next + a_value);
+        else if(a_constant && DCPU16::SUB == inst.op)
+            target.address = uint16_t(next - a_value);
+        else
+            return false;
+
+        targets->push_back(target);
+        return false;
+    }
+
+    switch(inst.ob)
+    {
+    case DCPU16::JSR:
+        if(a_constant)
+        {
+            target.address = a_value;
+            target.type = EDGE_CALL;
+            targets->push_back(target);
+        }
+        return true;
+
+    case DCPU16::IAS:
+        if(a_constant && a_value != 0)
+        {
+            target.address = a_value;
+            target.type = EDGE_INTERRUPT;
+            targets->push_back(target);
+        }
+        return true;
+
+    case DCPU16::RFI:
+        return false;
+
+    default:
+        break;
+    }
+
+    /* IAG PC and HWN PC */
+    if((op.flags & DCPU16::OPERATION_WRITES) && DCPU16::MODE_PC == a.mode)
+        return false;
+
+    return true;
+}
+
+/*
+ * @param address Address of the instruction a failed conditional skips.
+ *
+ * @return Address execution continues at after the skip.
+ */
+uint16_t ControlFlowGraph::getSkipTarget(const uint16_t *words, uint32_t num_words, uint16_t address)
+{
+    bool conditional;
+
+    do
+    {
+        Disassembler::Decoded inst;
+        Disassembler::decode(words, num_words, address, &inst);
+        conditional = DCPU16::getOperationInfo(inst.instruction).flags & DCPU16::OPERATION_CONDITIONAL;
+        address += inst.length;
+    } while(conditional);
+
+    return address;
+}
+
+size_t ControlFlowGraph::getBlockCount() const
+{
+    return blocks.size();
+}
+
+const ControlFlowGraph::Block* ControlFlowGraph::getBlock(size_t index) const
+{
+    if(index < blocks.size())
+        return &blocks[index];
+    return NULL;
+}
+
+static bool blockLess(const ControlFlowGraph::Block &block, uint16_t address)
+{
+    return block.start < address;
+}
+
+/*
+ * @return The block starting at or containing address, or NULL if address
+ * isn't in a block.
+ */
+const ControlFlowGraph::Block* ControlFlowGraph::findBlockFromAddress(uint16_t address) const
+{
+    std::vector<Block>::const_iterator it;
+    it = std::lower_bound(blocks.begin(), blocks.end(), address, blockLess);
+
+    if(it != blocks.end() && it->start == address)
+        return &*it;
+    if(it == blocks.begin())
+        return NULL;
+
+    --it;
+    if(uint32_t(address) < uint32_t(it->start) + it->length)
+        return &*it;
+    return NULL;
+}
+
+size_t ControlFlowGraph::getEdgeCount() const
+{
+    return edges.size();
+}
+
+const ControlFlowGraph::Edge* ControlFlowGraph::getEdge(size_t index) const
+{
+    if(index < edges.size())
+        return &edges[index];
+    return NULL;
+}
+
+size_t ControlFlowGraph::getOverlapCount() const
+{
+    return overlaps.size();
+}
+
+const ControlFlowGraph::Overlap* ControlFlowGraph::getOverlap(size_t index) const
+{
+    if(index < overlaps.size())
+        return &overlaps[index];
+    return NULL;
+}
+
+bool ControlFlowGraph::isInstructionStart(uint16_t address) const
+{
+    return !flags.empty() && (flags[address] & FLAG_START);
+}
+
+bool ControlFlowGraph::isCode(uint16_t address) const
+{
+    return !flags.empty() && (flags[address] & FLAG_CODE);
+}
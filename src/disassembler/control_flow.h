@@ -0,0 +1,109 @@
+#ifndef CONTROL_FLOW_H
+#define CONTROL_FLOW_H
+
+#include <vector>
+#include "disassembler.h"
+
+/*
+ * Basic block graph built by following control flow from a set of entry
+ * points instead of decoding memory linearly. Words never reached from an
+ * entry point are treated as data.
+ *
+ * Flow is followed through:
+ * - SET PC, literal and ADD/SUB PC, literal (jumps)
+ * - JSR literal (calls, which also fall through)
+ * - IFx (fall through and skip to the instruction after the next one)
+ * - IAS literal (adds the interrupt handler as an entry point)
+ *
+ * Any other write to PC, RFI and invalid opcodes end a block without known
+ * successors.
+ *
+ * A target inside an instruction decoded from another path still starts a
+ * block. Such overlapping instructions can't both be listed linearly, so the
+ * graph reports them as overlaps.
+ */
+class ControlFlowGraph
+{
+public:
+    enum
+    {
+        EDGE_FALLTHROUGH,
+        EDGE_JUMP,
+        EDGE_CALL,
+        EDGE_SKIP,
+        EDGE_INTERRUPT,
+    };
+
+    struct Block
+    {
+        /* Address of the first instruction. */
+        uint16_t start;
+
+        /* Number of words and instructions in the block. */
+        uint32_t length;
+        uint32_t num_instructions;
+
+        /* Indices into the graph's edges. */
+        std::vector<size_t> successors;
+        std::vector<size_t> predecessors;
+    };
+
+    struct Edge
+    {
+        /* Indices into the graph's blocks. */
+        size_t from;
+        size_t to;
+        int    type;
+    };
+
+    struct Overlap
+    {
+        /* Instruction start inside another instruction. */
+        uint16_t address;
+
+        /* Start of the instruction containing it. */
+        uint16_t instruction;
+    };
+
+
+private:
+    std::vector<Block> blocks;
+    std::vector<Edge> edges;
+    std::vector<Overlap> overlaps;
+
+    /* Per word flags. */
+    std::vector<uint8_t> flags;
+
+
+public:
+    void build(const uint16_t *words, uint32_t num_words, const std::vector<uint16_t> &entries);
+    void clear();
+
+    size_t getBlockCount() const;
+    const Block* getBlock(size_t index) const;
+    const Block* findBlockFromAddress(uint16_t address) const;
+    size_t getEdgeCount() const;
+    const Edge* getEdge(size_t index) const;
+    size_t getOverlapCount() const;
+    const Overlap* getOverlap(size_t index) const;
+
+    bool isInstructionStart(uint16_t address) const;
+    bool isCode(uint16_t address) const;
+
+private:
+    struct Target
+    {
+        uint16_t address;
+        int      type;
+    };
+
+    static bool getTargets(const Disassembler::Decoded &inst, const uint16_t *words, uint32_t num_words, std::vector<Target> *targets);
+    static uint16_t getSkipTarget(const uint16_t *words, uint32_t num_words, uint16_t address);
+
+    void discover(const uint16_t *words, uint32_t num_words, const std::vector<uint16_t> &entries);
+    void buildBlocks(const uint16_t *words, uint32_t num_words);
+    void findOverlaps(const uint16_t *words, uint32_t num_words);
+    void addEdge(size_t from, uint16_t to, int type);
+};
+
+#endif /* CONTROL_FLOW_H */
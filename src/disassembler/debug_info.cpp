@@ -0,0 +1,240 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "debug_info.h"
+
+static const char FILE_MAGIC[4] = {'D', 'D', 'I', '1'};
+
+static bool lineBefore(uint16_t address, const DebugInfo::LineEntry &entry)
+{
+    return address < entry.address;
+}
+
+static bool lineLess(const DebugInfo::LineEntry &a, const DebugInfo::LineEntry &b)
+{
+    return a.address < b.address;
+}
+
+static bool labelBefore(const DebugInfo::LabelEntry &entry, uint16_t address)
+{
+    return entry.address < address;
+}
+
+static bool labelAfter(uint16_t address, const DebugInfo::LabelEntry &entry)
+{
+    return address < entry.address;
+}
+
+static bool labelLess(const DebugInfo::Label &a, const DebugInfo::Label &b)
+{
+    return a.address < b.address;
+}
+
+
+DebugInfo::DebugInfo()
+{
+    map = NULL;
+    map_size = 0;
+    header = NULL;
+    lines = NULL;
+    labels = NULL;
+    names = NULL;
+}
+
+DebugInfo::~DebugInfo()
+{
+    close();
+}
+
+/*
+ * Maps a debug info file, replacing the one open before.
+ *
+ * @return false if the file couldn't be mapped or isn't valid debug info.
+ */
+bool DebugInfo::open(const char *path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if(ptr == MAP_FAILED)
+        return false;
+
+    map = ptr;
+    map_size = st.st_size;
+
+    const Header *h = static_cast<const Header*>(map);
+    uint64_t size = sizeof(Header) + uint64_t(h->num_lines) * sizeof(LineEntry) +
+                    uint64_t(h->num_labels) * sizeof(LabelEntry) + h->names_size;
+
+    if(memcmp(h->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || size != map_size ||
+       h->num_words > DCPU16::MEMORY_SIZE || (h->names_size && static_cast<const char*>(map)[map_size-1]))
+    {
+        close();
+        return false;
+    }
+
+    header = h;
+    lines = reinterpret_cast<const LineEntry*>(header + 1);
+    labels = reinterpret_cast<const LabelEntry*>(lines + header->num_lines);
+    names = reinterpret_cast<const char*>(labels + header->num_labels);
+
+    for(uint32_t i = 0; i < header->num_labels; i++)
+    {
+        if(labels[i].name >= header->names_size)
+        {
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void DebugInfo::close()
+{
+    if(map)
+        munmap(map, map_size);
+
+    map = NULL;
+    map_size = 0;
+    header = NULL;
+    lines = NULL;
+    labels = NULL;
+    names = NULL;
+}
+
+bool DebugInfo::isOpen() const
+{
+    return header != NULL;
+}
+
+/*
+ * @return The source line, counted from 1, the word at address was
+ *         assembled from, or 0 if it isn't part of the program.
+ */
+uint32_t DebugInfo::findLine(uint16_t address) const
+{
+    if(!header || address >= header->num_words)
+        return 0;
+
+    const LineEntry *entry = std::upper_bound(lines, lines + header->num_lines, address, lineBefore);
+    if(entry == lines)
+        return 0;
+
+    return entry[-1].line;
+}
+
+/*
+ * @return The first label at address, or NULL if there is none.
+ */
+const char* DebugInfo::findLabel(uint16_t address) const
+{
+    if(!header)
+        return NULL;
+
+    const LabelEntry *end = labels + header->num_labels;
+    const LabelEntry *entry = std::lower_bound(labels, end, address, labelBefore);
+
+    if(entry == end || entry->address != address)
+        return NULL;
+
+    return names + entry->name;
+}
+
+/*
+ * Finds the closest label at or before address, for naming addresses as
+ * label+offset.
+ *
+ * @return The label, or NULL if there are no labels before address.
+ */
+const char* DebugInfo::findSymbol(uint16_t address, uint16_t *offset) const
+{
+    if(!header)
+        return NULL;
+
+    const LabelEntry *entry = std::upper_bound(labels, labels + header->num_labels, address, labelAfter);
+    if(entry == labels)
+        return NULL;
+
+    uint16_t label_address = entry[-1].address;
+    *offset = address - label_address;
+    return findLabel(label_address);
+}
+
+/*
+ * Writes debug info for a program of num_words words. Lines and labels are
+ * sorted here, and lines covering no words should be left out.
+ *
+ * The file is written next to path and renamed over it, so a DebugInfo that
+ * has the old file mapped keeps seeing it whole.
+ *
+ * @return false if the file couldn't be written.
+ */
+bool DebugInfo::save(const char *path, uint32_t num_words,
+                     std::vector<LineEntry> lines, std::vector<Label> labels)
+{
+    std::stable_sort(lines.begin(), lines.end(), lineLess);
+    std::stable_sort(labels.begin(), labels.end(), labelLess);
+
+    std::vector<LabelEntry> label_entries(labels.size());
+    std::vector<char> label_names;
+
+    for(size_t i = 0; i < labels.size(); i++)
+    {
+        label_entries[i].address = labels[i].address;
+        label_entries[i].reserved = 0;
+        label_entries[i].name = label_names.size();
+
+        label_names.insert(label_names.end(), labels[i].name, labels[i].name + labels[i].length);
+        label_names.push_back('\0');
+    }
+
+    Header header;
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.num_words = num_words;
+    header.num_lines = lines.size();
+    header.num_labels = labels.size();
+    header.names_size = label_names.size();
+
+    std::string temp = std::string(path) + ".tmp";
+
+    FILE *file = fopen(temp.c_str(), "wb");
+    if(!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if(ok && !lines.empty())
+        ok = fwrite(&lines[0], sizeof(LineEntry), lines.size(), file) == lines.size();
+    if(ok && !label_entries.empty())
+        ok = fwrite(&label_entries[0], sizeof(LabelEntry), label_entries.size(), file) == label_entries.size();
+    if(ok && !label_names.empty())
+        ok = fwrite(&label_names[0], 1, label_names.size(), file) == label_names.size();
+    ok = fclose(file) == 0 && ok;
+
+    if(ok)
+        ok = rename(temp.c_str(), path) == 0;
+
+    if(!ok)
+        remove(temp.c_str());
+
+    return ok;
+}
@@ -0,0 +1,106 @@
+/*
+ * Debug info the assembler writes next to a program: the source line every
+ * word was assembled from and the labels' addresses.
+ *
+ * The file is used as it is on disk, memory mapped and searched in place,
+ * so opening it doesn't build anything. It holds a Header, the line table,
+ * the label table and the label names, each table sorted by address. Line
+ * entries cover the program without gaps, each running up to the next
+ * entry's address and the last up to the program's end. Names are NUL
+ * terminated. Numbers are in host byte order, like the program words.
+ */
+
+#ifndef DEBUG_INFO_H
+#define DEBUG_INFO_H
+
+#include <cstddef>
+#include <vector>
+#include "../dcpu16/dcpu16.h"
+
+class DebugInfo
+{
+/*---------------------------------------------------------------------------
+ * Types
+ *--------------------------------------------------------------------------*/
+public:
+    struct Header
+    {
+        char     magic[4];
+        uint32_t num_words;
+        uint32_t num_lines;
+        uint32_t num_labels;
+        uint32_t names_size;
+    };
+
+    struct LineEntry
+    {
+        uint16_t address;
+        uint16_t reserved;
+        uint32_t line;
+    };
+
+    struct LabelEntry
+    {
+        uint16_t address;
+        uint16_t reserved;
+
+        /* Offset of the name in the names. */
+        uint32_t name;
+    };
+
+    /* A label to save, with a name that isn't NUL terminated. */
+    struct Label
+    {
+        uint16_t    address;
+        const char *name;
+        size_t      length;
+    };
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    void *map;
+    size_t map_size;
+
+    const Header *header;
+    const LineEntry *lines;
+    const LabelEntry *labels;
+    const char *names;
+
+
+/*---------------------------------------------------------------------------
+ * Construct/Destruct
+ *--------------------------------------------------------------------------*/
+public:
+                        DebugInfo();
+                        ~DebugInfo();
+
+    bool                open(const char *path);
+    void                close();
+    bool                isOpen() const;
+
+private:
+                        DebugInfo(const DebugInfo&);
+    DebugInfo&          operator=(const DebugInfo&);
+
+
+/*---------------------------------------------------------------------------
+ * Lookups
+ *--------------------------------------------------------------------------*/
+public:
+    uint32_t            findLine(uint16_t address) const;
+    const char*         findLabel(uint16_t address) const;
+    const char*         findSymbol(uint16_t address, uint16_t *offset) const;
+
+
+/*---------------------------------------------------------------------------
+ * Files
+ *--------------------------------------------------------------------------*/
+public:
+    static bool         save(const char *path, uint32_t num_words,
+                             std::vector<LineEntry> lines, std::vector<Label> labels);
+};
+
+#endif /* DEBUG_INFO_H */
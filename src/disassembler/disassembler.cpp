@@ -1,63 +1,424 @@
 #include <cassert>
-#include <cstdio>
+#include <algorithm>
+#include <pthread.h>
 #include "disassembler.h"
+#include "control_flow.h"
 
-void Disassembler::disassemble(uint16_t *words, uint16_t num_words)
+void Disassembler::disassemble(const uint16_t *words, uint32_t num_words)
 {
     instructions.clear();
-    dcpu.loadProgram(words, num_words);
 
-    while(dcpu.read(DCPU16::RW_PROGRAM_COUNTER) < num_words)
+    for(uint32_t address = 0; address < num_words;)
     {
+        Decoded data;
+        decode(words, num_words, address, &data);
+
+        Instruction inst;
+        makeInstruction(data, static_cast<uint16_t>(instructions.size()), &inst);
+        instructions.push_back(inst);
+        address += data.length;
+    }
+}
+
+/*
+ * Linear disassembly split over several threads. Each thread decodes a chunk
+ * of words starting at the chunk's first word. Chunks are then merged in
+ * order: if the previous chunk's last instruction runs past the start of the
+ * next chunk, decoding continues from the real boundary until it lines up
+ * with an instruction the next chunk's thread already decoded.
+ *
+ * The result is the same as disassemble(words, num_words).
+ */
+void Disassembler::disassembleParallel(const uint16_t *words, uint32_t num_words, int num_threads)
+{
+    /* too little work to be worth a thread. */
+    const uint32_t min_chunk_words = 4096;
+
+    num_threads = std::max(1, std::min(num_threads, int(num_words / min_chunk_words)));
+
+    if(num_threads == 1)
+    {
+        disassemble(words, num_words);
+        return;
+    }
+
+    std::vector<Chunk> chunks(num_threads);
+    std::vector<pthread_t> threads(num_threads);
+    uint32_t chunk_words = num_words / num_threads;
+
+    for(int i = 0; i < num_threads; i++)
+    {
+        chunks[i].words = words;
+        chunks[i].num_words = num_words;
+        chunks[i].start = chunk_words * i;
+        chunks[i].end = i == num_threads-1 ? num_words : chunk_words * (i+1);
+    }
+
+    /* the first chunk is done on this thread. */
+    for(int i = 1; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, disassembleChunk, &chunks[i]);
+
+    disassembleChunk(&chunks[0]);
+
+    for(int i = 1; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    instructions.swap(chunks[0].instructions);
+
+    for(int i = 1; i < num_threads; i++)
+    {
+        const Instruction &last = instructions.back();
+        uint32_t pc = last.address + last.length;
+        std::vector<Instruction> &chunk = chunks[i].instructions;
+        size_t k = 0;
+
+        while(pc < chunks[i].end)
+        {
+            while(k < chunk.size() && chunk[k].address < pc)
+                k++;
+
+            if(k < chunk.size() && chunk[k].address == pc)
+            {
+                instructions.insert(instructions.end(), chunk.begin() + k, chunk.end());
+                break;
+            }
+
+            Decoded data;
+            decode(words, num_words, pc, &data);
+
+            Instruction inst;
+            makeInstruction(data, 0, &inst);
+            instructions.push_back(inst);
+            pc += data.length;
+        }
+    }
+
+    for(size_t i = 0; i < instructions.size(); i++)
+        instructions[i].index = static_cast<uint16_t>(i);
+}
+
+void* Disassembler::disassembleChunk(void *data)
+{
+    Chunk *chunk = static_cast<Chunk*>(data);
+
+    for(uint32_t address = chunk->start; address < chunk->end;)
+    {
+        Decoded decoded;
+        decode(chunk->words, chunk->num_words, address, &decoded);
+
         Instruction inst;
-        inst.address = dcpu.read(DCPU16::RW_PROGRAM_COUNTER);
-        inst.index = static_cast<uint16_t>(instructions.size());
-        InstructionData data = dcpu.nextInstruction();
+        makeInstruction(decoded, 0, &inst);
+        chunk->instructions.push_back(inst);
+        address += decoded.length;
+    }
 
-        sprintf(inst.address_str, "0x%04X", (int)inst.address);
-        sprintf(inst.operation_str, "%s", Disassembler::getOperationName(data.op, data.oa));
+    return NULL;
+}
+
+/*
+ * Disassembles only the words the control flow graph found to be code. All
+ * other words are emitted as data. Where the graph reports an overlap, only
+ * the instruction containing it is listed.
+ *
+ * @param graph Graph built from the same words.
+ */
+void Disassembler::disassemble(const uint16_t *words, uint32_t num_words, const ControlFlowGraph &graph)
+{
+    instructions.clear();
+
+    for(uint32_t address = 0; address < num_words;)
+    {
+        Instruction inst;
+        uint16_t index = static_cast<uint16_t>(instructions.size());
 
-        if(DCPU16::EXT != data.op)
+        if(graph.isInstructionStart(address))
         {
-            getOperandStr(data.oa, data.aptr, data.a, DCPU16::OPERAND_SOURCE_A, inst.operand_a_str);
-            getOperandStr(data.ob, data.bptr, data.b, DCPU16::OPERAND_SOURCE_B, inst.operand_b_str);
+            Decoded data;
+            decode(words, num_words, address, &data);
+            makeInstruction(data, index, &inst);
+            address += data.length;
         }
         else
         {
-            getOperandStr(data.ob, data.bptr, data.b, DCPU16::OPERAND_SOURCE_B, inst.operand_a_str);
-            inst.operand_b_str[0] = 0;
+            makeData(address, words[address], index, &inst);
+            address++;
         }
 
         instructions.push_back(inst);
     }
 }
 
-void Disassembler::getOperandStr(uint16_t operand, uint16_t *ptr, uint16_t value, char source, char *str)
-{
-    if(operand <= DCPU16::OPERAND_REGISTER)
-        sprintf(str, "%s", getRegisterName(operand));
-    else if(operand <= DCPU16::OPERAND_REGISTER_PTR)
-        sprintf(str, "[%s]", getRegisterName(operand));
-    else if(operand <= DCPU16::OPERAND_REGISTER_NEXT_WORD_PTR)
-        sprintf(str, "[0x%04X + %s]", (int)value, getRegisterName(operand));
-    else if(DCPU16::OPERAND_PUSH_POP == operand && DCPU16::OPERAND_SOURCE_A == source)
-        sprintf(str, "%s", "POP");
-    else if(DCPU16::OPERAND_PUSH_POP == operand && DCPU16::OPERAND_SOURCE_B == source)
-        sprintf(str, "%s", "PUSH");
-    else if(DCPU16::OPERAND_PEEK == operand)
-        sprintf(str, "%s", "PEEK");
-    else if(DCPU16::OPERAND_SP == operand)
-        sprintf(str, "%s", "SP");
-    else if(DCPU16::OPERAND_PC == operand)
-        sprintf(str, "%s", "PC");
-    else if(DCPU16::OPERAND_EX == operand)
-        sprintf(str, "%s", "0");
-    else if(DCPU16::OPERAND_NEXT_WORD_PTR == operand)
-        sprintf(str, "[0x%04X]", (int)(ptr - dcpu.memoryPointer()));
-    else if(DCPU16::OPERAND_NEXT_WORD_LITERAL == operand)
-        sprintf(str, "0x%04X", (int)value);
-    else
-        sprintf(str, "0x%04X", (int)value);
+/*
+ * Re-disassembles the instructions affected by a change to memory. Decoding
+ * starts at the instruction containing the first modified word and stops
+ * once it is past the modified words and lined up with an existing
+ * instruction again.
+ *
+ * @param words     Memory the instructions were disassembled from.
+ * @param num_words Number of words that were disassembled.
+ * @param address   First modified word.
+ * @param count     Number of modified words.
+ *
+ * Note: This assumes a linear disassembly. Code disassembled by control flow
+ * should be disassembled again from a rebuilt graph.
+ */
+void Disassembler::update(const uint16_t *words, uint32_t num_words, uint16_t address, uint16_t count)
+{
+    if(instructions.empty() || address >= num_words)
+        return;
+
+    size_t first = findIndexContaining(address);
+    uint32_t end = std::min(uint32_t(address) + count, num_words);
+    uint32_t pc = instructions[first].address;
+    size_t last = first;
+
+    std::vector<Instruction> decoded;
+
+    while(pc < num_words)
+    {
+        if(pc >= end)
+        {
+            /* skip old instructions that start before pc. */
+            while(last < instructions.size() && instructions[last].address < pc)
+                last++;
+
+            if(last < instructions.size() && instructions[last].address == pc)
+                break;
+        }
+
+        Decoded data;
+        decode(words, num_words, pc, &data);
+
+        Instruction inst;
+        makeInstruction(data, 0, &inst);
+        decoded.push_back(inst);
+        pc += data.length;
+    }
+
+    if(pc >= num_words)
+        last = instructions.size();
+
+    size_t replaced = std::max(last, first) - first;
+    instructions.erase(instructions.begin() + first, instructions.begin() + first + replaced);
+    instructions.insert(instructions.begin() + first, decoded.begin(), decoded.end());
+
+    /* indices only shift after the updated range when the count changed. */
+    size_t renumber_end = decoded.size() == replaced ? first + decoded.size() : instructions.size();
+    for(size_t i = first; i < renumber_end; i++)
+        instructions[i].index = static_cast<uint16_t>(i);
+}
+
+void Disassembler::makeData(uint16_t address, uint16_t word, uint16_t index, Instruction *inst)
+{
+    inst->address = address;
+    inst->index = index;
+    inst->instruction = word;
+    inst->a_word = 0;
+    inst->b_word = 0;
+    inst->length = 1;
+    inst->flags = INSTRUCTION_DATA;
+}
+
+void Disassembler::makeInstruction(const Decoded &data, uint16_t index, Instruction *inst)
+{
+    inst->address = data.address;
+    inst->index = index;
+    inst->instruction = data.instruction;
+    inst->a_word = data.a_word;
+    inst->b_word = data.b_word;
+    inst->length = uint8_t(data.length);
+    inst->flags = 0;
+}
+
+/*
+ * Decodes a single instruction. Words past num_words read as 0 and addresses
+ * wrap around the 16 bit address space like the cpu's program counter.
+ *
+ * @param words     Memory to decode from.
+ * @param num_words Number of valid words in memory.
+ * @param address   Address of the instruction.
+ * @param inst      Receives the decoded instruction.
+ */
+void Disassembler::decode(const uint16_t *words, uint32_t num_words, uint16_t address, Decoded *inst)
+{
+    uint16_t pc = address;
+
+    inst->address     = address;
+    inst->instruction = pc < num_words ? words[pc] : 0;
+    pc++;
+
+    inst->op = (inst->instruction & DCPU16::INST_OP_MASK) >> DCPU16::INST_OP_SHIFT;
+    inst->oa = (inst->instruction & DCPU16::INST_VA_MASK) >> DCPU16::INST_VA_SHIFT;
+    inst->ob = (inst->instruction & DCPU16::INST_VB_MASK) >> DCPU16::INST_VB_SHIFT;
+    inst->a_word = 0;
+    inst->b_word = 0;
+
+    /* next words are read in operand processing order, a before b. */
+    if(DCPU16::getOperandInfo(inst->oa).next_word)
+    {
+        inst->a_word = pc < num_words ? words[pc] : 0;
+        pc++;
+    }
+
+    if(DCPU16::EXT != inst->op && DCPU16::getOperandInfo(inst->ob).next_word)
+    {
+        inst->b_word = pc < num_words ? words[pc] : 0;
+        pc++;
+    }
+
+    inst->length = uint16_t(pc - address);
+}
+
+/*
+ * Decodes a single instruction into a record format() accepts, for callers
+ * that only need a few instructions rather than a whole disassembly.
+ */
+void Disassembler::decode(const uint16_t *words, uint32_t num_words, uint16_t address, Instruction *inst)
+{
+    Decoded data;
+    decode(words, num_words, address, &data);
+    makeInstruction(data, 0, inst);
+}
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static char* writeHex(char *p, uint16_t value)
+{
+    p[0] = '0';
+    p[1] = 'x';
+    p[2] = hex_digits[(value >> 12) & 0xF];
+    p[3] = hex_digits[(value >>  8) & 0xF];
+    p[4] = hex_digits[(value >>  4) & 0xF];
+    p[5] = hex_digits[(value >>  0) & 0xF];
+    return p + 6;
+}
+
+static char* writeString(char *p, const char *str)
+{
+    while(*str)
+        *p++ = *str++;
+    return p;
+}
+
+/*
+ * Formats an instruction as "address operation operands".
+ *
+ * @param buffer Receives the text. Must hold MAX_FORMAT_LENGTH characters.
+ *
+ * @return Length of the text, not including the terminator.
+ */
+int Disassembler::format(const Instruction &inst, char *buffer)
+{
+    char *p = writeHex(buffer, inst.address);
+    *p++ = ' ';
+    p = writeOperation(inst, p);
+    *p++ = ' ';
+    p = writeOperands(inst, p);
+    *p = 0;
+    return int(p - buffer);
+}
+
+/*
+ * Formats just the operation name, or DAT for data words.
+ */
+int Disassembler::formatOperation(const Instruction &inst, char *buffer)
+{
+    char *p = writeOperation(inst, buffer);
+    *p = 0;
+    return int(p - buffer);
+}
+
+/*
+ * Formats the operands in assembly order, b before a.
+ */
+int Disassembler::formatOperands(const Instruction &inst, char *buffer)
+{
+    char *p = writeOperands(inst, buffer);
+    *p = 0;
+    return int(p - buffer);
+}
+
+char* Disassembler::writeOperation(const Instruction &inst, char *p)
+{
+    if(inst.flags & INSTRUCTION_DATA)
+        return writeString(p, "DAT");
+    return writeString(p, getOperationName(inst.instruction));
+}
+
+char* Disassembler::writeOperands(const Instruction &inst, char *p)
+{
+    if(inst.flags & INSTRUCTION_DATA)
+        return writeHex(p, inst.instruction);
+
+    uint16_t op = (inst.instruction & DCPU16::INST_OP_MASK) >> DCPU16::INST_OP_SHIFT;
+    uint16_t oa = (inst.instruction & DCPU16::INST_VA_MASK) >> DCPU16::INST_VA_SHIFT;
+    uint16_t ob = (inst.instruction & DCPU16::INST_VB_MASK) >> DCPU16::INST_VB_SHIFT;
+
+    if(DCPU16::EXT != op)
+    {
+        p = writeOperand(ob, inst.b_word, DCPU16::OPERAND_SOURCE_B, p);
+        *p++ = ',';
+        *p++ = ' ';
+    }
+
+    return writeOperand(oa, inst.a_word, DCPU16::OPERAND_SOURCE_A, p);
+}
+
+char* Disassembler::writeOperand(uint16_t operand, uint16_t next_word, char source, char *p)
+{
+    const OperandInfo &info = DCPU16::getOperandInfo(operand);
+    const char *reg = getRegisterName(info.reg);
+
+    switch(info.mode)
+    {
+    case DCPU16::MODE_REGISTER:
+        return writeString(p, reg);
+
+    case DCPU16::MODE_REGISTER_PTR:
+        *p++ = '[';
+        p = writeString(p, reg);
+        *p++ = ']';
+        return p;
+
+    case DCPU16::MODE_REGISTER_NEXT_WORD_PTR:
+        *p++ = '[';
+        p = writeHex(p, next_word);
+        p = writeString(p, " + ");
+        p = writeString(p, reg);
+        *p++ = ']';
+        return p;
+
+    case DCPU16::MODE_PUSH_POP:
+        return writeString(p, DCPU16::OPERAND_SOURCE_A == source ? "POP" : "PUSH");
+
+    case DCPU16::MODE_PEEK:
+        return writeString(p, "PEEK");
+
+    case DCPU16::MODE_PICK:
+        p = writeString(p, "PICK ");
+        return writeHex(p, next_word);
+
+    case DCPU16::MODE_SP:
+        return writeString(p, "SP");
+
+    case DCPU16::MODE_PC:
+        return writeString(p, "PC");
+
+    case DCPU16::MODE_EX:
+        return writeString(p, "EX");
+
+    case DCPU16::MODE_NEXT_WORD_PTR:
+        *p++ = '[';
+        p = writeHex(p, next_word);
+        *p++ = ']';
+        return p;
+
+    case DCPU16::MODE_NEXT_WORD_LITERAL:
+        return writeHex(p, next_word);
+
+    default:
+        return writeHex(p, info.literal);
+    }
 }
 
 const Disassembler::Instruction* Disassembler::getInstruction(uint16_t index) const
@@ -67,48 +428,56 @@ const Disassembler::Instruction* Disassembler::getInstruction(uint16_t index) co
     return NULL;
 }
 
+static bool addressLess(const Disassembler::Instruction &inst, uint16_t address)
+{
+    return inst.address < address;
+}
+
 const Disassembler::Instruction* Disassembler::findInstructionFromAddress(uint16_t address) const
 {
-    for(size_t i = 0; i < instructions.size(); i++)
-        if(address == instructions[i].address)
-            return &instructions[i];
+    std::vector<Instruction>::const_iterator it;
+    it = std::lower_bound(instructions.begin(), instructions.end(), address, addressLess);
+
+    if(it != instructions.end() && it->address == address)
+        return &*it;
     return NULL;
 }
 
+/*
+ * @return The instruction whose words include address, or NULL if address
+ * is before the first instruction.
+ */
+const Disassembler::Instruction* Disassembler::findInstructionContaining(uint16_t address) const
+{
+    if(instructions.empty() || address < instructions[0].address)
+        return NULL;
+    return &instructions[findIndexContaining(address)];
+}
+
+/*
+ * @return Index of the last instruction starting at or before address, or 0
+ * if there is none.
+ */
+size_t Disassembler::findIndexContaining(uint16_t address) const
+{
+    std::vector<Instruction>::const_iterator it;
+    it = std::lower_bound(instructions.begin(), instructions.end(), uint16_t(address + 1), addressLess);
+
+    if(address == 0xFFFF)
+        it = instructions.end();
+
+    return it == instructions.begin() ? 0 : size_t(it - instructions.begin()) - 1;
+}
+
 size_t Disassembler::getInstructionCount() const
 {
     return instructions.size();
 }
 
-const char* Disassembler::getOperationName(uint16_t op, uint16_t oa)
+const char* Disassembler::getOperationName(uint16_t instruction)
 {
-    switch(op)
-    {
-    case DCPU16::SET: return "SET";
-    case DCPU16::ADD: return "ADD";
-    case DCPU16::SUB: return "SUB";
-    case DCPU16::MUL: return "MUL";
-    case DCPU16::DIV: return "DIV";
-    case DCPU16::MOD: return "MOD";
-    case DCPU16::SHL: return "SHL";
-    case DCPU16::SHR: return "SHR";
-    case DCPU16::AND: return "AND";
-    case DCPU16::BOR: return "BOR";
-    case DCPU16::XOR: return "XOR";
-    case DCPU16::IFE: return "IFE";
-    case DCPU16::IFN: return "IFN";
-    case DCPU16::IFG: return "IFG";
-    case DCPU16::IFB: return "IFB";
-    case DCPU16::EXT:
-        switch(oa)
-        {
-        case DCPU16::JSR: return "JSR";
-        }
-
-    default: break;
-    }
-    
-    return "???";
+    const char *name = DCPU16::getOperationInfo(instruction).name;
+    return name ? name : "???";
 }
 
 const char* Disassembler::getRegisterName(uint16_t i)
@@ -4,37 +4,97 @@
 #include <vector>
 #include "../dcpu16/dcpu16.h"
 
+class ControlFlowGraph;
+
+/*
+ * Instructions are kept sorted by address and cover the disassembled words
+ * without gaps, so address lookups are binary searches. When disassembling
+ * by control flow, words that aren't reached as code are emitted as DAT.
+ */
+
 class Disassembler
 {
 public:
+    enum
+    {
+        /* Longest text format() writes, including the terminator. */
+        MAX_FORMAT_LENGTH = 48,
+    };
+
+    enum
+    {
+        /* The instruction is a data word that wasn't reached as code. */
+        INSTRUCTION_DATA = 0x01,
+    };
+
+    /*
+     * Compact record of a disassembled instruction. Text is produced on
+     * demand with format().
+     */
     struct Instruction
     {
         uint16_t address;
         uint16_t index;
-        char address_str[8];
-        char operation_str[8];
-        char operand_a_str[32];
-        char operand_b_str[32];
+        uint16_t instruction;
+        uint16_t a_word, b_word;
+        uint8_t  length;
+        uint8_t  flags;
+    };
+
+    /*
+     * Fields of an instruction decoded straight from memory, without
+     * resolving operand values.
+     */
+    struct Decoded
+    {
+        uint16_t address;
+        uint16_t instruction;
+        uint16_t op, oa, ob;
+        uint16_t a_word, b_word;
+        uint16_t length;
     };
 
 
 public:
-    static const char* getOperationName(uint16_t op, uint16_t oa);
+    static const char* getOperationName(uint16_t instruction);
     static const char* getRegisterName(uint16_t i);
+    static void        decode(const uint16_t *words, uint32_t num_words, uint16_t address, Decoded *inst);
+    static void        decode(const uint16_t *words, uint32_t num_words, uint16_t address, Instruction *inst);
+
+    static int         format(const Instruction &inst, char *buffer);
+    static int         formatOperation(const Instruction &inst, char *buffer);
+    static int         formatOperands(const Instruction &inst, char *buffer);
 
 
 private:
-    DCPU16 dcpu;
     std::vector<Instruction> instructions;
 
 public:
-    void disassemble(uint16_t *words, uint16_t num_words);
+    void disassemble(const uint16_t *words, uint32_t num_words);
+    void disassemble(const uint16_t *words, uint32_t num_words, const ControlFlowGraph &graph);
+    void disassembleParallel(const uint16_t *words, uint32_t num_words, int num_threads);
+    void update(const uint16_t *words, uint32_t num_words, uint16_t address, uint16_t count);
     const Instruction* getInstruction(uint16_t index) const;
     const Instruction* findInstructionFromAddress(uint16_t address) const;
+    const Instruction* findInstructionContaining(uint16_t address) const;
     size_t getInstructionCount() const;
 
 private:
-    void getOperandStr(uint16_t operand, uint16_t *ptr, uint16_t value, char source, char *str);
+    struct Chunk
+    {
+        const uint16_t *words;
+        uint32_t num_words;
+        uint32_t start, end;
+        std::vector<Instruction> instructions;
+    };
+
+    static void* disassembleChunk(void *chunk);
+    size_t findIndexContaining(uint16_t address) const;
+    static void makeInstruction(const Decoded &data, uint16_t index, Instruction *inst);
+    static void makeData(uint16_t address, uint16_t word, uint16_t index, Instruction *inst);
+    static char* writeOperation(const Instruction &inst, char *p);
+    static char* writeOperands(const Instruction &inst, char *p);
+    static char* writeOperand(uint16_t operand, uint16_t next_word, char source, char *p);
 };
 
 #endif /* DISASSEMBLER_H */
@@ -1,25 +1,223 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <pthread.h>
 #include "disassembler.h"
+#include "control_flow.h"
+#include "debug_info.h"
 
-int main()
+/*
+ * Usage: disassembler [-j threads] [-e entry]... dump...
+ *
+ * Dumps are raw memory images of up to 0x10000 words in host byte order. A
+ * single dump is printed to stdout and disassembled using all threads.
+ * Several dumps are disassembled concurrently, one per thread, and each is
+ * written next to its dump with a .dasm extension.
+ *
+ * Given entry points, code is found by following control flow from them
+ * and the words it never reaches are listed as data. Jumps into the middle
+ * of another instruction are reported on stderr.
+ *
+ * If the assembler wrote debug info for a dump, <dump>.dbg, its labels and
+ * source line numbers are added to the disassembly.
+ */
+
+struct Batch
+{
+    std::vector<const char*> paths;
+    std::vector<uint16_t> entries;
+    size_t next;
+    int failures;
+    pthread_mutex_t lock;
+};
+
+static bool readDump(const char *path, std::vector<uint16_t> *words)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        return false;
+
+    words->resize(DCPU16::MEMORY_SIZE);
+    size_t n = fread(&(*words)[0], sizeof(uint16_t), words->size(), file);
+    words->resize(n);
+
+    fclose(file);
+    return true;
+}
+
+/*
+ * Formats every instruction into one output buffer which is written out
+ * whenever it fills up. With debug info, labels are printed before the
+ * instructions they point to and a comment gives the source line wherever
+ * it changes.
+ */
+static void print(FILE *out, const Disassembler &d, const DebugInfo *info)
 {
-    uint16_t prog[32] = {
-        0x7c01, 0x0030, 0x7de1, 0x1000, 0x0020, 0x7803, 0x1000, 0xc00d,
-        0x7dc1, 0x001a, 0xa861, 0x7c01, 0x2000, 0x2161, 0x2000, 0x8463,
-        0x806d, 0x7dc1, 0x000d, 0x9031, 0x7c10, 0x0018, 0x7dc1, 0x001a,
-        0x9037, 0x61c1, 0x7dc1, 0x001a
-    };
+    const size_t buffer_size = 1 << 16;
+    std::vector<char> buffer(buffer_size);
+    size_t used = 0;
+    uint32_t last_line = 0;
+
+    for(size_t i = 0; i < d.getInstructionCount(); i++)
+    {
+        const Disassembler::Instruction &inst = *d.getInstruction(i);
+        const char *label = info ? info->findLabel(inst.address) : NULL;
+        size_t label_length = label ? strlen(label) + 2 : 0;
+
+        /* room for the instruction, a line comment and the label. */
+        if(buffer_size - used < Disassembler::MAX_FORMAT_LENGTH + 32 + label_length)
+        {
+            fwrite(&buffer[0], 1, used, out);
+            used = 0;
+        }
+
+        if(label && label_length > buffer_size / 2)
+        {
+            fwrite(&buffer[0], 1, used, out);
+            used = 0;
+            fprintf(out, ":%s\n", label);
+        }
+        else if(label)
+        {
+            used += sprintf(&buffer[used], ":%s\n", label);
+        }
+
+        used += Disassembler::format(inst, &buffer[used]);
+
+        uint32_t line = info ? info->findLine(inst.address) : 0;
+        if(line && line != last_line)
+            used += sprintf(&buffer[used], " ; line %u", line);
+        last_line = line;
+
+        buffer[used++] = '\n';
+    }
+
+    fwrite(&buffer[0], 1, used, out);
+}
+
+/*
+ * Disassembles by control flow from the entry points.
+ */
+static void disassembleGraph(const char *path, const std::vector<uint16_t> &words,
+                             const std::vector<uint16_t> &entries, Disassembler *d)
+{
+    ControlFlowGraph graph;
+    graph.build(&words[0], words.size(), entries);
+    d->disassemble(&words[0], words.size(), graph);
+
+    for(size_t i = 0; i < graph.getOverlapCount(); i++)
+    {
+        const ControlFlowGraph::Overlap *overlap = graph.getOverlap(i);
+        fprintf(stderr, "disassembler: %s: 0x%04X jumps into the instruction at 0x%04X\n",
+                path, overlap->address, overlap->instruction);
+    }
+}
+
+static bool disassembleFile(const char *path, const std::vector<uint16_t> &entries,
+                            FILE *out, int num_threads)
+{
+    std::vector<uint16_t> words;
+
+    if(!readDump(path, &words))
+    {
+        fprintf(stderr, "disassembler: can't read %s\n", path);
+        return false;
+    }
 
     Disassembler d;
-    d.disassemble(prog, 28);
+    if(!words.empty() && !entries.empty())
+        disassembleGraph(path, words, entries, &d);
+    else if(!words.empty())
+        d.disassembleParallel(&words[0], words.size(), num_threads);
 
-    for(uint16_t i = 0; i < d.getInstructionCount(); i++)
+    DebugInfo info;
+    std::string info_path = std::string(path) + ".dbg";
+    const DebugInfo *annotations = info.open(info_path.c_str()) ? &info : NULL;
+
+    if(out)
+    {
+        print(out, d, annotations);
+        return true;
+    }
+
+    std::string out_path = std::string(path) + ".dasm";
+    out = fopen(out_path.c_str(), "w");
+    if(!out)
+    {
+        fprintf(stderr, "disassembler: can't write %s\n", out_path.c_str());
+        return false;
+    }
+
+    print(out, d, annotations);
+    fclose(out);
+    return true;
+}
+
+static void* batchWorker(void *data)
+{
+    Batch *batch = static_cast<Batch*>(data);
+
+    while(true)
     {
-        const Disassembler::Instruction *inst = d.getInstruction(i);
-        printf("%s ",  inst->address_str);
-        printf("%s ",  inst->operation_str);
-        printf("%s ",  inst->operand_a_str);
-        printf("%s\n", inst->operand_b_str);
+        pthread_mutex_lock(&batch->lock);
+        size_t i = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+
+        if(i >= batch->paths.size())
+            break;
+
+        if(!disassembleFile(batch->paths[i], batch->entries, NULL, 1))
+        {
+            pthread_mutex_lock(&batch->lock);
+            batch->failures++;
+            pthread_mutex_unlock(&batch->lock);
+        }
     }
+
+    return NULL;
 }
 
+int main(int argc, char **argv)
+{
+    int num_threads = 1;
+    Batch batch;
+    batch.next = 0;
+    batch.failures = 0;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-j") == 0 && i+1 < argc)
+            num_threads = std::max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "-e") == 0 && i+1 < argc)
+            batch.entries.push_back(uint16_t(strtoul(argv[++i], NULL, 0)));
+        else
+            batch.paths.push_back(argv[i]);
+    }
+
+    if(batch.paths.empty())
+    {
+        fprintf(stderr, "usage: disassembler [-j threads] [-e entry]... dump...\n");
+        return 1;
+    }
+
+    if(batch.paths.size() == 1)
+        return disassembleFile(batch.paths[0], batch.entries, stdout, num_threads) ? 0 : 1;
+
+    num_threads = std::min(num_threads, int(batch.paths.size()));
+    std::vector<pthread_t> threads(num_threads);
+    pthread_mutex_init(&batch.lock, NULL);
+
+    for(int i = 1; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, batchWorker, &batch);
+
+    batchWorker(&batch);
+
+    for(int i = 1; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&batch.lock);
+    return batch.failures ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <unistd.h>
+
+#include "fork_explorer.h"
+
+
+ForkExplorer::ForkExplorer(const DCPU16 &parent)
+{
+    this->parent = new DCPU16(parent);
+    this->parent->detachAllDevices();
+    this->parent->setStats(NULL);
+    this->parent->setHooks(NULL);
+    this->parent->setAccessCounters(NULL);
+    this->parent->setInputLog(NULL);
+
+    std::fill(targets, targets + DCPU16::MEMORY_SIZE/32, 0);
+    max_steps = 1000000;
+}
+
+ForkExplorer::~ForkExplorer()
+{
+    delete parent;
+}
+
+/*
+ * A variant reaches a target when it is about to execute the instruction
+ * at addr.
+ */
+void ForkExplorer::addTarget(uint16_t addr)
+{
+    targets[addr / 32] |= 1u << (addr % 32);
+}
+
+/*
+ * Sets the number of steps after which a variant stops with OUTCOME_LIMIT.
+ */
+void ForkExplorer::setMaxSteps(uint64_t steps)
+{
+    max_steps = steps;
+}
+
+/*
+ * Runs all variants and stores their results in the same order.
+ *
+ * @param num_threads   Number of threads to run variants on, all cores if 0.
+ *                      The calling thread is one of them.
+ */
+void ForkExplorer::explore(const std::vector<Variant> &variants,
+                           std::vector<Result> *results,
+                           int num_threads) const
+{
+    results->resize(variants.size());
+    if(variants.empty())
+        return;
+
+    if(num_threads <= 0)
+        num_threads = std::max(1, int(sysconf(_SC_NPROCESSORS_ONLN)));
+    num_threads = int(std::min(size_t(num_threads), variants.size()));
+
+    Run run;
+    run.explorer = this;
+    run.variants = &variants;
+    run.results = results;
+    run.next = 0;
+
+    std::vector<pthread_t> threads(num_threads);
+    pthread_mutex_init(&run.lock, NULL);
+
+    for(int i = 1; i < num_threads; i++)
+        pthread_create(&threads[i], NULL, worker, &run);
+
+    worker(&run);
+
+    for(int i = 1; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&run.lock);
+}
+
+void* ForkExplorer::worker(void *data)
+{
+    Run *run = static_cast<Run*>(data);
+    DCPU16 *cpu = new DCPU16();
+    cpu->setErrorPrinting(false);
+
+    while(true)
+    {
+        pthread_mutex_lock(&run->lock);
+        size_t i = run->next++;
+        pthread_mutex_unlock(&run->lock);
+
+        if(i >= run->variants->size())
+            break;
+
+        run->explorer->runVariant(cpu, (*run->variants)[i], &(*run->results)[i]);
+    }
+
+    delete cpu;
+    return NULL;
+}
+
+void ForkExplorer::runVariant(DCPU16 *cpu, const Variant &variant, Result *result) const
+{
+    cpu->fork(*parent);
+
+    for(size_t i = 0; i < variant.patches.size(); i++)
+        cpu->write(variant.patches[i].address, variant.patches[i].value);
+
+    uint64_t steps = 0;
+    result->outcome = OUTCOME_LIMIT;
+
+    while(true)
+    {
+        if(cpu->getError())
+        {
+            result->outcome = OUTCOME_ERROR;
+            break;
+        }
+
+        if(isTarget(cpu->pc))
+        {
+            result->outcome = OUTCOME_TARGET;
+            break;
+        }
+
+        if(steps == max_steps)
+            break;
+
+        cpu->step();
+        steps++;
+    }
+
+    result->error = cpu->getError();
+    result->pc = cpu->pc;
+    result->steps = steps;
+    result->cycles = cpu->getCycles() - parent->getCycles();
+}
+
+bool ForkExplorer::isTarget(uint16_t addr) const
+{
+    return (targets[addr / 32] >> (addr % 32)) & 1;
+}
@@ -0,0 +1,114 @@
+#ifndef FORK_EXPLORER_H
+#define FORK_EXPLORER_H
+
+#include <vector>
+#include <pthread.h>
+#include "../dcpu16/dcpu16.h"
+
+/*
+ * Runs many variants of one cpu state in parallel and reports which of them
+ * reach a target address, stop with an error or run out of steps.
+ *
+ * A variant is the parent state with a few memory words or registers
+ * changed. Every thread keeps one cpu that is forked from the parent for
+ * each variant it runs, so only the memory pages the previous variant wrote
+ * are copied rather than the whole state.
+ *
+ * Variants run without devices: the explorer keeps its own copy of the
+ * parent with the devices, their events, stats, hooks, access counters and
+ * the input log detached, since those can't be shared between threads.
+ */
+class ForkExplorer
+{
+/*---------------------------------------------------------------------------
+ * Types
+ *--------------------------------------------------------------------------*/
+public:
+    enum
+    {
+        /* The variant reached one of the target addresses. */
+        OUTCOME_TARGET,
+
+        /* The cpu stopped with an error. */
+        OUTCOME_ERROR,
+
+        /* The variant ran for the maximum number of steps. */
+        OUTCOME_LIMIT,
+    };
+
+    /*
+     * A word written before the variant runs. address is anything
+     * DCPU16::write() accepts, so registers are patched like memory.
+     */
+    struct Patch
+    {
+        uint32_t address;
+        uint16_t value;
+    };
+
+    struct Variant
+    {
+        std::vector<Patch> patches;
+    };
+
+    struct Result
+    {
+        int      outcome;
+        int      error;
+        uint16_t pc;
+
+        /* Steps and cycles the variant ran from the parent state. */
+        uint64_t steps;
+        uint64_t cycles;
+    };
+
+private:
+    struct Run
+    {
+        const ForkExplorer         *explorer;
+        const std::vector<Variant> *variants;
+        std::vector<Result>        *results;
+        size_t                      next;
+        pthread_mutex_t             lock;
+    };
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    DCPU16 *parent;
+    uint32_t targets[DCPU16::MEMORY_SIZE / 32];
+    uint64_t max_steps;
+
+
+/*---------------------------------------------------------------------------
+ * Construct/Destruct
+ *--------------------------------------------------------------------------*/
+public:
+                        ForkExplorer(const DCPU16 &parent);
+                        ~ForkExplorer();
+
+    void                addTarget(uint16_t addr);
+    void                setMaxSteps(uint64_t steps);
+
+private:
+                        ForkExplorer(const ForkExplorer&);
+    ForkExplorer&       operator=(const ForkExplorer&);
+
+
+/*---------------------------------------------------------------------------
+ * Exploring
+ *--------------------------------------------------------------------------*/
+public:
+    void                explore(const std::vector<Variant> &variants,
+                                std::vector<Result> *results,
+                                int num_threads = 0) const;
+
+private:
+    static void*        worker(void *data);
+    void                runVariant(DCPU16 *cpu, const Variant &variant, Result *result) const;
+    bool                isTarget(uint16_t addr) const;
+};
+
+#endif /* FORK_EXPLORER_H */
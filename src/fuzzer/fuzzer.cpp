@@ -0,0 +1,350 @@
+#include <cstring>
+#include <algorithm>
+
+#include "fuzzer.h"
+
+/*
+ * Values that often hit edge cases, tried in place of input words.
+ */
+static const uint16_t INTERESTING[] = {
+    0x0000, 0x0001, 0x0002, 0x000A, 0x0020, 0x0030, 0x0039, 0x0041,
+    0x007F, 0x0080, 0x00FF, 0x0100, 0x7FFF, 0x8000, 0xFFFE, 0xFFFF,
+};
+
+static const int NUM_INTERESTING = sizeof(INTERESTING) / sizeof(INTERESTING[0]);
+
+/*
+ * Hit counts are compared in buckets, so a loop running a few more times
+ * doesn't count as new coverage but running a different order of
+ * magnitude of times does.
+ */
+static uint8_t bucket(uint8_t count)
+{
+    if(count <= 3)
+        return count == 3 ? 4 : count;
+    if(count <= 7)
+        return 8;
+    if(count <= 15)
+        return 16;
+    if(count <= 31)
+        return 32;
+    if(count <= 127)
+        return 64;
+    return 128;
+}
+
+
+/*
+ * @param snapshot          State every execution starts from. The fuzzer
+ *                          keeps a copy without devices or anything else
+ *                          attached.
+ * @param input_address     First word of the input region.
+ * @param input_size        Number of input words, wrapping around the end
+ *                          of memory.
+ */
+Fuzzer::Fuzzer(const DCPU16 &snapshot, uint16_t input_address, uint16_t input_size)
+{
+    this->snapshot = new DCPU16(snapshot);
+    this->snapshot->detachAllDevices();
+    this->snapshot->setStats(NULL);
+    this->snapshot->setHooks(NULL);
+    this->snapshot->setCoverage(NULL);
+    this->snapshot->setAccessCounters(NULL);
+    this->snapshot->setInputLog(NULL);
+
+    cpu = new DCPU16();
+    cpu->setCoverage(&coverage);
+    cpu->setErrorPrinting(false);
+
+    memset(coverage.map, 0, sizeof(coverage.map));
+    coverage.num_hits = 0;
+    memset(virgin, 0xFF, sizeof(virgin));
+
+    this->input_address = input_address;
+    this->input_size = input_size;
+    std::fill(stops, stops + DCPU16::MEMORY_SIZE/32, 0);
+    max_steps = 10000;
+
+    random_state = 1;
+    memset(&stats, 0, sizeof(stats));
+}
+
+Fuzzer::~Fuzzer()
+{
+    delete cpu;
+    delete snapshot;
+}
+
+/*
+ * An execution finishes when it is about to execute the instruction at
+ * addr.
+ */
+void Fuzzer::addStopAddress(uint16_t addr)
+{
+    stops[addr / 32] |= 1u << (addr % 32);
+}
+
+/*
+ * Sets the number of steps after which an execution times out.
+ */
+void Fuzzer::setMaxSteps(uint64_t steps)
+{
+    max_steps = steps;
+}
+
+void Fuzzer::setRandomSeed(uint32_t seed)
+{
+    random_state = seed ? seed : 1;
+}
+
+/*
+ * Runs an input and adds it to the corpus even if it finds nothing new.
+ * Inputs are cut or padded with zeros to the size of the input region.
+ */
+void Fuzzer::addSeed(const uint16_t *words, size_t count)
+{
+    std::vector<uint16_t> seed(words, words + std::min(count, size_t(input_size)));
+    seed.resize(input_size, 0);
+
+    size_t corpus_size = corpus.size();
+    execute(seed);
+
+    if(corpus.size() == corpus_size)
+        corpus.push_back(seed);
+}
+
+/*
+ * Runs execs mutated inputs. Without seeds the snapshot's input region is
+ * the first seed.
+ */
+void Fuzzer::fuzz(uint64_t execs)
+{
+    if(corpus.empty())
+    {
+        std::vector<uint16_t> seed(input_size);
+        for(uint16_t i = 0; i < input_size; i++)
+            seed[i] = snapshot->mem[uint16_t(input_address + i)];
+        addSeed(seed.empty() ? NULL : &seed[0], seed.size());
+    }
+
+    for(uint64_t i = 0; i < execs; i++)
+    {
+        input = corpus[random(corpus.size())];
+        mutate(&input);
+        execute(input);
+    }
+}
+
+/*
+ * Runs one input from the snapshot. Inputs with new coverage are added to
+ * the corpus and new crashes are recorded.
+ *
+ * @return The OUTCOME_* of the execution.
+ */
+int Fuzzer::execute(const std::vector<uint16_t> &input)
+{
+    cpu->fork(*snapshot);
+
+    uint16_t count = uint16_t(std::min(input.size(), size_t(input_size)));
+    for(uint16_t i = 0; i < count; i++)
+        cpu->mem[uint16_t(input_address + i)] = input[i];
+    cpu->markDirty(input_address, count);
+
+    coverage.previous = 0;
+    stats.execs++;
+
+    uint64_t steps = 0;
+    int outcome;
+
+    while(true)
+    {
+        if(cpu->getError())
+        {
+            outcome = OUTCOME_ERROR;
+            break;
+        }
+
+        if((stops[cpu->pc / 32] >> (cpu->pc % 32)) & 1)
+        {
+            outcome = OUTCOME_FINISHED;
+            break;
+        }
+
+        if(steps == max_steps)
+        {
+            outcome = OUTCOME_TIMEOUT;
+            break;
+        }
+
+        cpu->step<DCPU16::CoverageHooks>();
+        steps++;
+
+        /* nothing but an interrupt gets a cpu out of a jump to itself. */
+        if(cpu->pc == cpu->last_instruction.instruction_address && !cpu->interrupt_count)
+        {
+            outcome = cpu->getError() ? OUTCOME_ERROR : OUTCOME_FINISHED;
+            break;
+        }
+    }
+
+    if(outcome == OUTCOME_FINISHED)
+    {
+        if(updateCoverage())
+        {
+            corpus.push_back(input);
+            corpus.back().resize(input_size, 0);
+        }
+        return outcome;
+    }
+
+    clearCoverage();
+
+    if(outcome == OUTCOME_TIMEOUT)
+    {
+        stats.timeouts++;
+        return outcome;
+    }
+
+    stats.errors++;
+
+    uint16_t address = cpu->last_instruction.instruction_address;
+    if(crash_sites.insert(uint32_t(cpu->getError()) << 16 | address).second)
+    {
+        Crash crash;
+        crash.input = input;
+        crash.error = cpu->getError();
+        crash.address = address;
+        crashes.push_back(crash);
+    }
+
+    return outcome;
+}
+
+const std::vector<std::vector<uint16_t> >& Fuzzer::getCorpus() const
+{
+    return corpus;
+}
+
+const std::vector<Fuzzer::Crash>& Fuzzer::getCrashes() const
+{
+    return crashes;
+}
+
+const Fuzzer::Stats& Fuzzer::getStats() const
+{
+    return stats;
+}
+
+/*
+ * Merges the coverage of the last execution into virgin and clears the map
+ * for the next one.
+ *
+ * @return true if the execution hit a new edge or hit count bucket.
+ */
+bool Fuzzer::updateCoverage()
+{
+    bool found = false;
+
+    for(uint32_t i = 0; i < coverage.num_hits; i++)
+    {
+        uint16_t edge = coverage.hits[i];
+        uint8_t hit = bucket(coverage.map[edge]);
+
+        coverage.map[edge] = 0;
+
+        if(hit & virgin[edge])
+        {
+            if(virgin[edge] == 0xFF)
+                stats.edges++;
+
+            virgin[edge] &= ~hit;
+            found = true;
+        }
+    }
+
+    coverage.num_hits = 0;
+    return found;
+}
+
+void Fuzzer::clearCoverage()
+{
+    for(uint32_t i = 0; i < coverage.num_hits; i++)
+        coverage.map[coverage.hits[i]] = 0;
+
+    coverage.num_hits = 0;
+}
+
+/*
+ * Applies a stack of 1 to 8 random mutations, in the style of AFL's havoc
+ * stage.
+ */
+void Fuzzer::mutate(std::vector<uint16_t> *input)
+{
+    std::vector<uint16_t> &words = *input;
+    uint32_t size = words.size();
+    if(size == 0)
+        return;
+
+    int num_mutations = 1 << random(4);
+
+    for(int m = 0; m < num_mutations; m++)
+    {
+        uint32_t at = random(size);
+
+        switch(random(8))
+        {
+        case 0:
+            words[at] ^= 1 << random(16);
+            break;
+
+        case 1:
+            words[at] = INTERESTING[random(NUM_INTERESTING)];
+            break;
+
+        case 2:
+            words[at] += 1 + random(35);
+            break;
+
+        case 3:
+            words[at] -= 1 + random(35);
+            break;
+
+        case 4:
+            /* text is stored one character per word. */
+            words[at] = random(0x80);
+            break;
+
+        case 5:
+            words[at] = random(0x10000);
+            break;
+
+        case 6:
+        {
+            uint32_t from = random(size);
+            uint32_t length = 1 + random(size - std::max(at, from));
+            memmove(&words[at], &words[from], length * sizeof(uint16_t));
+            break;
+        }
+
+        case 7:
+        {
+            /* splice the same range from another input. */
+            const std::vector<uint16_t> &other = corpus[random(corpus.size())];
+            uint32_t length = 1 + random(size - at);
+            std::copy(other.begin() + at, other.begin() + at + length, words.begin() + at);
+            break;
+        }
+        }
+    }
+}
+
+/*
+ * @return A random number below range, from a xorshift generator.
+ */
+uint32_t Fuzzer::random(uint32_t range)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return uint32_t((uint64_t(random_state) * range) >> 32);
+}
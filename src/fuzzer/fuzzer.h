@@ -0,0 +1,125 @@
+#ifndef FUZZER_H
+#define FUZZER_H
+
+#include <set>
+#include <vector>
+#include "../dcpu16/dcpu16.h"
+
+/*
+ * Coverage guided fuzzer for a guest program's input handling, in the style
+ * of AFL.
+ *
+ * Every execution starts from the same snapshot of the cpu: a cpu forked
+ * from the snapshot has the input words written to a fixed region of memory
+ * and runs until it reaches a stop address, jumps to itself, stops with an
+ * error or runs out of steps. Restoring the snapshot only copies the pages
+ * the previous execution wrote.
+ *
+ * The edges executed are counted in an EdgeCoverage map. Inputs that hit an
+ * edge for the first time, or hit one a number of times not seen before,
+ * are added to the corpus that mutated inputs are made from. Inputs that
+ * stop with an error are kept as crashes, one per error and instruction
+ * address.
+ *
+ * The fuzzer runs on the calling thread. Independent fuzzers with
+ * different random seeds can run on other cores.
+ */
+class Fuzzer
+{
+/*---------------------------------------------------------------------------
+ * Types
+ *--------------------------------------------------------------------------*/
+public:
+    enum
+    {
+        /* Reached a stop address or jumped to itself. */
+        OUTCOME_FINISHED,
+
+        /* Stopped with an error. */
+        OUTCOME_ERROR,
+
+        /* Ran for the maximum number of steps. */
+        OUTCOME_TIMEOUT,
+    };
+
+    struct Crash
+    {
+        std::vector<uint16_t> input;
+        int      error;
+
+        /* Address of the instruction that caused the error. */
+        uint16_t address;
+    };
+
+    struct Stats
+    {
+        uint64_t execs;
+        uint64_t errors;
+        uint64_t timeouts;
+
+        /* Map entries hit by any execution so far. */
+        uint32_t edges;
+    };
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    DCPU16 *snapshot;
+    DCPU16 *cpu;
+    EdgeCoverage coverage;
+
+    /* Hit count buckets not seen yet, per map entry. */
+    uint8_t virgin[EdgeCoverage::MAP_SIZE];
+
+    uint16_t input_address;
+    uint16_t input_size;
+    uint32_t stops[DCPU16::MEMORY_SIZE / 32];
+    uint64_t max_steps;
+
+    std::vector<std::vector<uint16_t> > corpus;
+    std::vector<Crash> crashes;
+    std::set<uint32_t> crash_sites;
+    std::vector<uint16_t> input;
+
+    uint32_t random_state;
+    Stats stats;
+
+
+/*---------------------------------------------------------------------------
+ * Construct/Destruct
+ *--------------------------------------------------------------------------*/
+public:
+                        Fuzzer(const DCPU16 &snapshot, uint16_t input_address, uint16_t input_size);
+                        ~Fuzzer();
+
+    void                addStopAddress(uint16_t addr);
+    void                setMaxSteps(uint64_t steps);
+    void                setRandomSeed(uint32_t seed);
+
+private:
+                        Fuzzer(const Fuzzer&);
+    Fuzzer&             operator=(const Fuzzer&);
+
+
+/*---------------------------------------------------------------------------
+ * Fuzzing
+ *--------------------------------------------------------------------------*/
+public:
+    void                addSeed(const uint16_t *words, size_t count);
+    void                fuzz(uint64_t execs);
+    int                 execute(const std::vector<uint16_t> &input);
+
+    const std::vector<std::vector<uint16_t> >& getCorpus() const;
+    const std::vector<Crash>& getCrashes() const;
+    const Stats&        getStats() const;
+
+private:
+    bool                updateCoverage();
+    void                clearCoverage();
+    void                mutate(std::vector<uint16_t> *input);
+    uint32_t            random(uint32_t range);
+};
+
+#endif /* FUZZER_H */
@@ -0,0 +1,184 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+#include "fuzzer.h"
+
+/*
+ * Usage: fuzzer [-n execs] [-m max-steps] [-e entry] [-x stop-address]...
+ *               [-r random-seed] [-o output-dir]
+ *               program input-address input-size [seed]...
+ *
+ * The program is a raw image in host byte order, loaded at address 0. If
+ * an entry address is given the program runs up to it once and the
+ * snapshot is taken there, so setup code before reading the input doesn't
+ * run for every input. Seeds are raw input words in host byte order.
+ *
+ * The corpus and crashes are written to the output directory as
+ * queue-<n>.bin and crash-<n>.bin once the fuzzer is done.
+ */
+
+static bool readWords(const char *path, std::vector<uint16_t> *words)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        return false;
+
+    words->resize(DCPU16::MEMORY_SIZE);
+    size_t n = fread(&(*words)[0], sizeof(uint16_t), words->size(), file);
+    words->resize(n);
+
+    fclose(file);
+    return true;
+}
+
+static bool writeWords(const std::string &path, const std::vector<uint16_t> &words)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if(!file)
+        return false;
+
+    bool ok = words.empty() || fwrite(&words[0], sizeof(uint16_t), words.size(), file) == words.size();
+    return fclose(file) == 0 && ok;
+}
+
+static std::string outputPath(const char *dir, const char *name, size_t i)
+{
+    char file[64];
+    sprintf(file, "/%s-%05zu.bin", name, i);
+    return dir + std::string(file);
+}
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: fuzzer [-n execs] [-m max-steps] [-e entry] [-x stop-address]... "
+                    "[-r random-seed] [-o output-dir] program input-address input-size [seed]...\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t execs = 1000000;
+    uint64_t max_steps = 10000;
+    long entry = -1;
+    std::vector<uint16_t> stops;
+    uint32_t random_seed = 1;
+    const char *output_dir = ".";
+    std::vector<const char*> args;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(i+1 < argc && strcmp(argv[i], "-n") == 0)
+            execs = strtoull(argv[++i], NULL, 0);
+        else if(i+1 < argc && strcmp(argv[i], "-m") == 0)
+            max_steps = strtoull(argv[++i], NULL, 0);
+        else if(i+1 < argc && strcmp(argv[i], "-e") == 0)
+            entry = strtol(argv[++i], NULL, 0) & 0xFFFF;
+        else if(i+1 < argc && strcmp(argv[i], "-x") == 0)
+            stops.push_back(uint16_t(strtoul(argv[++i], NULL, 0)));
+        else if(i+1 < argc && strcmp(argv[i], "-r") == 0)
+            random_seed = uint32_t(strtoul(argv[++i], NULL, 0));
+        else if(i+1 < argc && strcmp(argv[i], "-o") == 0)
+            output_dir = argv[++i];
+        else
+            args.push_back(argv[i]);
+    }
+
+    if(args.size() < 3)
+    {
+        usage();
+        return 1;
+    }
+
+    std::vector<uint16_t> program;
+    if(!readWords(args[0], &program))
+    {
+        fprintf(stderr, "could not read %s\n", args[0]);
+        return 1;
+    }
+
+    /* the fuzzer reports errors itself. */
+    DCPU16 *cpu = new DCPU16();
+    cpu->setErrorPrinting(false);
+
+    /* copied rather than loaded, since loadProgram can't take a full 0x10000 words. */
+    std::copy(program.begin(), program.end(), cpu->mem);
+    cpu->markDirty(0, program.size());
+
+    for(uint64_t steps = 0; entry >= 0 && cpu->pc != entry; steps++)
+    {
+        if(cpu->getError() || steps == max_steps)
+        {
+            fprintf(stderr, "the program didn't reach the entry address\n");
+            return 1;
+        }
+        cpu->step();
+    }
+
+    Fuzzer *fuzzer = new Fuzzer(*cpu, uint16_t(strtoul(args[1], NULL, 0)), uint16_t(strtoul(args[2], NULL, 0)));
+    fuzzer->setMaxSteps(max_steps);
+    fuzzer->setRandomSeed(random_seed);
+    for(size_t i = 0; i < stops.size(); i++)
+        fuzzer->addStopAddress(stops[i]);
+
+    for(size_t i = 3; i < args.size(); i++)
+    {
+        std::vector<uint16_t> seed;
+        if(!readWords(args[i], &seed))
+        {
+            fprintf(stderr, "could not read %s\n", args[i]);
+            return 1;
+        }
+        fuzzer->addSeed(seed.empty() ? NULL : &seed[0], seed.size());
+    }
+
+    double start = now();
+    double last_report = start;
+
+    for(uint64_t done = 0; done < execs; )
+    {
+        uint64_t batch = std::min<uint64_t>(execs - done, 4096);
+        fuzzer->fuzz(batch);
+        done += batch;
+
+        double t = now();
+        if(t - last_report >= 1.0 || done == execs)
+        {
+            const Fuzzer::Stats &stats = fuzzer->getStats();
+            fprintf(stderr, "execs %llu (%.0f/s), corpus %zu, edges %u, crashes %zu, timeouts %llu\n",
+                    (unsigned long long)stats.execs, stats.execs / (t - start),
+                    fuzzer->getCorpus().size(), stats.edges,
+                    fuzzer->getCrashes().size(), (unsigned long long)stats.timeouts);
+            last_report = t;
+        }
+    }
+
+    int failures = 0;
+
+    for(size_t i = 0; i < fuzzer->getCorpus().size(); i++)
+        failures += !writeWords(outputPath(output_dir, "queue", i), fuzzer->getCorpus()[i]);
+
+    for(size_t i = 0; i < fuzzer->getCrashes().size(); i++)
+    {
+        const Fuzzer::Crash &crash = fuzzer->getCrashes()[i];
+        failures += !writeWords(outputPath(output_dir, "crash", i), crash.input);
+        fprintf(stderr, "crash-%05zu.bin: %s at 0x%04x\n", i,
+                DCPU16::getErrorString(crash.error), crash.address);
+    }
+
+    if(failures)
+        fprintf(stderr, "could not write %d files to %s\n", failures, output_dir);
+
+    delete fuzzer;
+    delete cpu;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics_exporter.h"
+
+/*
+ * Escapes a label value as the text format requires.
+ */
+static std::string escapeLabel(const std::string &value)
+{
+    std::string escaped;
+
+    for(size_t i = 0; i < value.size(); i++)
+    {
+        switch(value[i])
+        {
+        case '\\': escaped += "\\\\"; break;
+        case '"':  escaped += "\\\""; break;
+        case '\n': escaped += "\\n";  break;
+        default:   escaped += value[i]; break;
+        }
+    }
+
+    return escaped;
+}
+
+static void writeHeader(std::ostringstream &out, const char *name, const char *type, const char *help)
+{
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+
+MetricsExporter::MetricsExporter()
+{
+    last_export = now();
+    started = false;
+    quit = false;
+    sem_init(&wake, 0, 0);
+    target = TARGET_FILE;
+    interval_ms = 0;
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+    sem_destroy(&wake);
+}
+
+/*
+ * Adds a cpu to export. stats must outlive the exporter. Instances may only
+ * be added before start().
+ */
+void MetricsExporter::addInstance(const char *name, const RuntimeStats *stats)
+{
+    Instance instance;
+    instance.name = escapeLabel(name);
+    instance.stats = stats;
+    instance.instructions = RuntimeStats::load(&stats->instructions);
+    instance.cycles = RuntimeStats::load(&stats->cycles);
+    instance.interrupts = RuntimeStats::load(&stats->interrupts);
+
+    instances.push_back(instance);
+}
+
+/*
+ * @return The current stats of all instances. Rates are over the time since
+ *         the previous call.
+ */
+std::string MetricsExporter::format()
+{
+    std::ostringstream out;
+    double time = now();
+    double elapsed = time - last_export;
+    last_export = time;
+
+    writeHeader(out, "dcpu16_instructions_total", "counter", "Instructions executed.");
+    for(size_t i = 0; i < instances.size(); i++)
+        out << "dcpu16_instructions_total{instance=\"" << instances[i].name << "\"} "
+            << RuntimeStats::load(&instances[i].stats->instructions) << "\n";
+
+    writeHeader(out, "dcpu16_cycles_total", "counter", "Cycles executed.");
+    for(size_t i = 0; i < instances.size(); i++)
+        out << "dcpu16_cycles_total{instance=\"" << instances[i].name << "\"} "
+            << RuntimeStats::load(&instances[i].stats->cycles) << "\n";
+
+    writeHeader(out, "dcpu16_interrupts_total", "counter", "Interrupts triggered.");
+    for(size_t i = 0; i < instances.size(); i++)
+        out << "dcpu16_interrupts_total{instance=\"" << instances[i].name << "\"} "
+            << RuntimeStats::load(&instances[i].stats->interrupts) << "\n";
+
+    writeHeader(out, "dcpu16_hwi_calls_total", "counter", "HWI instructions per device.");
+    for(size_t i = 0; i < instances.size(); i++)
+    {
+        const RuntimeStats *stats = instances[i].stats;
+
+        for(int device = 0; device < RuntimeStats::MAX_DEVICES; device++)
+        {
+            uint64_t calls = RuntimeStats::load(&stats->hwi_calls[device]);
+            if(calls)
+                out << "dcpu16_hwi_calls_total{instance=\"" << instances[i].name
+                    << "\",device=\"" << device << "\"} " << calls << "\n";
+        }
+
+        uint64_t other = RuntimeStats::load(&stats->hwi_other);
+        if(other)
+            out << "dcpu16_hwi_calls_total{instance=\"" << instances[i].name
+                << "\",device=\"other\"} " << other << "\n";
+    }
+
+    writeHeader(out, "dcpu16_errors_total", "counter", "Errors that stopped the cpu.");
+    for(size_t i = 0; i < instances.size(); i++)
+    {
+        /* ERROR_NONE is never counted. */
+        for(int err = 1; err < RuntimeStats::MAX_ERRORS; err++)
+            out << "dcpu16_errors_total{instance=\"" << instances[i].name
+                << "\",error=\"" << DCPU16::getErrorString(err) << "\"} "
+                << RuntimeStats::load(&instances[i].stats->errors[err]) << "\n";
+    }
+
+    writeHeader(out, "dcpu16_history_bytes", "gauge", "Memory used by debugger history.");
+    for(size_t i = 0; i < instances.size(); i++)
+        out << "dcpu16_history_bytes{instance=\"" << instances[i].name << "\"} "
+            << RuntimeStats::load(&instances[i].stats->history_bytes) << "\n";
+
+    /* rates, which also moves the previous counters forward. */
+    std::vector<uint64_t> instructions(instances.size());
+    std::vector<uint64_t> cycles(instances.size());
+    std::vector<uint64_t> interrupts(instances.size());
+
+    for(size_t i = 0; i < instances.size(); i++)
+    {
+        instructions[i] = RuntimeStats::load(&instances[i].stats->instructions);
+        cycles[i] = RuntimeStats::load(&instances[i].stats->cycles);
+        interrupts[i] = RuntimeStats::load(&instances[i].stats->interrupts);
+    }
+
+    if(elapsed <= 0)
+        elapsed = 1;
+
+    writeHeader(out, "dcpu16_instructions_per_second", "gauge", "Instructions per second since the previous export.");
+    for(size_t i = 0; i < instances.size(); i++)
+        out << "dcpu16_instructions_per_second{instance=\"" << instances[i].name << "\"} "
+            << (instructions[i] - instances[i].instructions) / elapsed << "\n";
+
+    writeHeader(out, "dcpu16_cycles_per_second", "gauge", "Cycles per second since the previous export.");
+    for(size_t i = 0; i < instances.size(); i++)
+        out << "dcpu16_cycles_per_second{instance=\"" << instances[i].name << "\"} "
+            << (cycles[i] - instances[i].cycles) / elapsed << "\n";
+
+    writeHeader(out, "dcpu16_interrupts_per_second", "gauge", "Interrupts per second since the previous export.");
+    for(size_t i = 0; i < instances.size(); i++)
+        out << "dcpu16_interrupts_per_second{instance=\"" << instances[i].name << "\"} "
+            << (interrupts[i] - instances[i].interrupts) / elapsed << "\n";
+
+    for(size_t i = 0; i < instances.size(); i++)
+    {
+        instances[i].instructions = instructions[i];
+        instances[i].cycles = cycles[i];
+        instances[i].interrupts = interrupts[i];
+    }
+
+    return out.str();
+}
+
+/*
+ * Writes the stats to a temporary file next to path and renames it over
+ * path.
+ *
+ * @return false if the file couldn't be written.
+ */
+bool MetricsExporter::writeFile(const char *path)
+{
+    std::string text = format();
+    std::string temp = std::string(path) + ".tmp";
+
+    FILE *file = fopen(temp.c_str(), "w");
+    if(!file)
+        return false;
+
+    bool ok = fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = fclose(file) == 0 && ok;
+
+    if(ok)
+        ok = rename(temp.c_str(), path) == 0;
+
+    if(!ok)
+        remove(temp.c_str());
+
+    return ok;
+}
+
+/*
+ * Connects to the Unix stream socket at path and sends the stats.
+ *
+ * @return false if nothing is listening or the connection was dropped.
+ */
+bool MetricsExporter::writeSocket(const char *path)
+{
+    sockaddr_un address;
+    if(strlen(path) >= sizeof(address.sun_path))
+        return false;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return false;
+
+    if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    std::string text = format();
+    size_t sent = 0;
+
+    while(sent < text.size())
+    {
+        ssize_t n = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+
+        sent += n;
+    }
+
+    close(fd);
+    return sent == text.size();
+}
+
+double MetricsExporter::now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Starts exporting to path every interval_ms on a thread of its own. target
+ * is TARGET_FILE or TARGET_SOCKET. Failed exports are retried on the next
+ * interval.
+ *
+ * @return false if the thread couldn't be started.
+ */
+bool MetricsExporter::start(const char *path, int target, int interval_ms)
+{
+    if(started)
+        return false;
+
+    this->target_path = path;
+    this->target = target;
+    this->interval_ms = interval_ms;
+    quit = false;
+
+    started = pthread_create(&thread, NULL, threadMain, this) == 0;
+    return started;
+}
+
+void MetricsExporter::stop()
+{
+    if(!started)
+        return;
+
+    __atomic_store_n(&quit, true, __ATOMIC_RELEASE);
+    sem_post(&wake);
+    pthread_join(thread, NULL);
+    started = false;
+}
+
+void* MetricsExporter::threadMain(void *data)
+{
+    static_cast<MetricsExporter*>(data)->loop();
+    return NULL;
+}
+
+void MetricsExporter::loop()
+{
+    while(!__atomic_load_n(&quit, __ATOMIC_ACQUIRE))
+    {
+        /* sem_timedwait only takes a realtime deadline. */
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval_ms / 1000;
+        deadline.tv_nsec += (interval_ms % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while(sem_timedwait(&wake, &deadline) != 0 && errno == EINTR)
+            ;
+
+        if(__atomic_load_n(&quit, __ATOMIC_ACQUIRE))
+            break;
+
+        if(target == TARGET_SOCKET)
+            writeSocket(target_path.c_str());
+        else
+            writeFile(target_path.c_str());
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <semaphore.h>
+#include "../dcpu16/dcpu16.h"
+
+/*
+ * Exports the RuntimeStats of any number of cpus in the Prometheus text
+ * format.
+ *
+ * Counters are exported as they are, and rates over the last export
+ * interval are exported as gauges alongside them. Exports go either to a
+ * file, replaced atomically so a collector never sees a partial write, or
+ * to a Unix stream socket that is connected to and sent the text once per
+ * export.
+ */
+class MetricsExporter
+{
+/*---------------------------------------------------------------------------
+ * Types
+ *--------------------------------------------------------------------------*/
+public:
+    enum
+    {
+        TARGET_FILE,
+        TARGET_SOCKET,
+    };
+
+private:
+    struct Instance
+    {
+        std::string         name;
+        const RuntimeStats *stats;
+
+        /* Counters at the previous export, for rates. */
+        uint64_t            instructions;
+        uint64_t            cycles;
+        uint64_t            interrupts;
+    };
+
+
+/*---------------------------------------------------------------------------
+ * Members
+ *--------------------------------------------------------------------------*/
+private:
+    std::vector<Instance> instances;
+    double last_export;
+
+    pthread_t thread;
+    bool started;
+    bool quit;
+
+    /* Posted to stop the export thread without waiting for its interval. */
+    sem_t wake;
+
+    std::string target_path;
+    int target;
+    int interval_ms;
+
+
+/*---------------------------------------------------------------------------
+ * Construct/Destruct
+ *--------------------------------------------------------------------------*/
+public:
+                        MetricsExporter();
+                        ~MetricsExporter();
+
+    void                addInstance(const char *name, const RuntimeStats *stats);
+
+
+/*---------------------------------------------------------------------------
+ * Exporting
+ *--------------------------------------------------------------------------*/
+public:
+    std::string         format();
+    bool                writeFile(const char *path);
+    bool                writeSocket(const char *path);
+
+private:
+    static double       now();
+
+
+/*---------------------------------------------------------------------------
+ * Periodic Export
+ *--------------------------------------------------------------------------*/
+public:
+    bool                start(const char *path, int target, int interval_ms);
+    void                stop();
+
+private:
+    static void*        threadMain(void *data);
+    void                loop();
+};
+
+#endif /* METRICS_EXPORTER_H */